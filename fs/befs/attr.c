@@ -0,0 +1,382 @@
+/*
+ *  linux/fs/befs/attr.c
+ *
+ * Copyright (C) 1999  Makoto Kato (m_kato@ga2.so-net.ne.jp)
+ *
+ *  Attributes of BEFS.  Small attributes are kept as small data in inode
+ *  block.  The others are files in attribute directory of inode.
+ */
+
+#include <asm/uaccess.h>
+
+#include <linux/errno.h>
+#include <linux/fs.h>
+#include <linux/befs_fs.h>
+#include <linux/sched.h>
+#include <linux/stat.h>
+#include <linux/string.h>
+#include <linux/locks.h>
+#include <linux/malloc.h>
+
+
+/*
+ * befs_read_small_data
+ *
+ * description:
+ *  Copy small data attributes of inode block to inode.  Headers are
+ *  converted to CPU byte order.  The file name is not copied.
+ *
+ * parameter:
+ *  inode      ... inode
+ *  fstype     ... filesystem type
+ *  disk_inode ... inode block
+ *  inode_size ... size of inode block
+ *
+ * return value:
+ *  0 ... success
+ */
+
+int befs_read_small_data (struct inode * inode, int fstype,
+	befs_inode * disk_inode, int inode_size)
+{
+	befs_small_data * sd;
+	befs_small_data * new;
+	char *           end;
+	char *           data;
+	int              name_size;
+	int              data_size;
+	int              size;
+	int              pass;
+
+	if (inode_size > inode->i_sb->s_blocksize)
+		inode_size = inode->i_sb->s_blocksize;
+	end = (char *) disk_inode + inode_size;
+
+	/*
+	 * At first pass, count size.  At second pass, copy.
+	 */
+
+	data = NULL;
+	size = 0;
+	for (pass = 0; pass < 2; pass++) {
+		new = (befs_small_data *) data;
+		sd = BEFS_INODE_SD(disk_inode);
+
+		/*
+		 * The first one must be file name.  Otherwise small data
+		 * is broken (or misplaced), and no attribute is read.
+		 */
+
+		name_size = (char *) (sd + 1) < end ?
+			befs16_to_cpu(fstype, sd->name_size) : 0;
+		if (!pass && name_size && (name_size != 1
+			|| *BEFS_SD_NAME(sd) != BEFS_FILE_NAME_NAME)) {
+
+			printk (KERN_ERR "BEFS: small data does not start "
+				"with file name - inode = %lu\n", inode->i_ino);
+			return 0;
+		}
+
+		while ((char *) (sd + 1) <= end) {
+			name_size = befs16_to_cpu(fstype, sd->name_size);
+			data_size = befs16_to_cpu(fstype, sd->data_size);
+
+			if (!name_size
+				|| (char *) sd + BEFS_SD_SIZE(name_size,
+				data_size) > end)
+				break;
+
+			if (name_size != 1 || *BEFS_SD_NAME(sd)
+				!= BEFS_FILE_NAME_NAME) {
+
+				if (pass) {
+					memcpy (new, sd, BEFS_SD_SIZE(name_size,
+						data_size));
+					new->type = befs32_to_cpu(fstype,
+						sd->type);
+					new->name_size = name_size;
+					new->data_size = data_size;
+					new = BEFS_SD_NEXT(new);
+				} else
+					size += BEFS_SD_SIZE(name_size,
+						data_size);
+			}
+
+			sd = (befs_small_data *) ((char *) sd
+				+ BEFS_SD_SIZE(name_size, data_size));
+		}
+
+		if (!size)
+			return 0;
+
+		if (!pass) {
+			data = (char *) kmalloc (size, GFP_KERNEL);
+			if (!data)
+				return -ENOMEM;
+			BEFS_STAT_ALLOC(inode->i_sb, BEFS_ST_READ_INODE);
+		}
+	}
+
+	inode->u.befs_i.i_small_data = data;
+	inode->u.befs_i.i_small_size = size;
+
+	return 0;
+}
+
+
+/*
+ * befs_find_small_data
+ *
+ * description:
+ *  Find small data of attribute name in inode.
+ */
+
+static befs_small_data * befs_find_small_data (struct inode * inode,
+	const char * name, int len)
+{
+	befs_small_data * sd;
+	char *           end;
+
+	sd = (befs_small_data *) inode->u.befs_i.i_small_data;
+	end = inode->u.befs_i.i_small_data + inode->u.befs_i.i_small_size;
+
+	for (; sd && (char *) sd < end; sd = BEFS_SD_NEXT(sd)) {
+		if (sd->name_size == len
+			&& !memcmp (BEFS_SD_NAME(sd), name, len))
+			return sd;
+	}
+
+	return NULL;
+}
+
+
+/*
+ * befs_attr_dir
+ *
+ * description:
+ *  Get inode of attribute directory, or NULL if inode has no attribute
+ *  directory.
+ */
+
+static struct inode * befs_attr_dir (struct inode * inode)
+{
+	struct super_block * sb = inode->i_sb;
+	struct inode *       dir;
+
+	if (BEFS_IS_EMPTY_IADDR(&inode->u.befs_i.i_attribute))
+		return NULL;
+
+	dir = iget (sb, BEFS_IADDR2INO(&inode->u.befs_i.i_attribute,
+		&sb->u.befs_sb));
+	if (!dir)
+		return NULL;
+
+	if (is_bad_inode (dir) || !S_ISDIR(dir->i_mode)) {
+		printk (KERN_ERR "BEFS: bad attribute directory - "
+			"inode = %lu\n", inode->i_ino);
+		iput (dir);
+		return NULL;
+	}
+
+	return dir;
+}
+
+
+/*
+ * befs_read_attr
+ *
+ * description:
+ *  Copy data stream of attribute inode to user buffer.
+ */
+
+static int befs_read_attr (struct inode * attr, char * buf, int size)
+{
+	struct buffer_head * bh;
+	int                  block_size = attr->i_sb->s_blocksize;
+	int                  pos;
+	int                  len;
+
+	for (pos = 0; pos < size; pos += len) {
+		bh = befs_bread_stream (attr, pos);
+		if (!bh)
+			return -EIO;
+
+		len = block_size;
+		if (len > size - pos)
+			len = size - pos;
+
+		if (copy_to_user (buf + pos, bh->b_data, len)) {
+			brelse (bh);
+			return -EFAULT;
+		}
+		brelse (bh);
+	}
+
+	return 0;
+}
+
+
+/*
+ * befs_getattr
+ *
+ * description:
+ *  Get type and data of attribute.  Small data is looked up first, and
+ *  attribute directory is read only if it is not found.
+ *
+ * return value:
+ *  length of data, -ERANGE if buffer is short, -ENODATA if not found
+ */
+
+int befs_getattr (struct inode * inode, befs_attr_io * io)
+{
+	befs_small_data * sd;
+	struct inode *   dir;
+	struct inode *   attr;
+	befs_off_t        ino;
+	char             name[BEFS_NAME_LEN + 1];
+	int              size;
+	int              err;
+
+	if (io->name_len <= 0)
+		return -EINVAL;
+	if (io->name_len > BEFS_NAME_LEN)
+		return -ENAMETOOLONG;
+	if (copy_from_user (name, io->name, io->name_len))
+		return -EFAULT;
+
+	sd = befs_find_small_data (inode, name, io->name_len);
+	if (sd) {
+		io->type = sd->type;
+		if (!io->size)
+			return sd->data_size;
+		if (io->size < sd->data_size)
+			return -ERANGE;
+		if (copy_to_user (io->buf, BEFS_SD_DATA(sd), sd->data_size))
+			return -EFAULT;
+
+		return sd->data_size;
+	}
+
+	/*
+	 * large attribute
+	 */
+
+	dir = befs_attr_dir (inode);
+	if (!dir)
+		return -ENODATA;
+
+	ino = befs_find_entry (dir, name, io->name_len);
+	iput (dir);
+	if (!ino)
+		return -ENODATA;
+
+	attr = iget (inode->i_sb, (ino_t) ino);
+	if (!attr)
+		return -EIO;
+	if (is_bad_inode (attr)) {
+		iput (attr);
+		return -EIO;
+	}
+
+	io->type = attr->u.befs_i.i_type;
+	size = attr->i_size;
+
+	if (!io->size)
+		err = 0;
+	else if (io->size < size)
+		err = -ERANGE;
+	else
+		err = befs_read_attr (attr, io->buf, size);
+
+	iput (attr);
+
+	return err ? err : size;
+}
+
+
+/*
+ * befs_listattr
+ *
+ * description:
+ *  Get names of all attributes.  Each name is followed by NUL.
+ *
+ * return value:
+ *  length of names, -ERANGE if buffer is short
+ */
+
+int befs_listattr (struct inode * inode, befs_attr_io * io)
+{
+	befs_small_data * sd;
+	struct inode *   dir;
+	befs_index_entry  entry;
+	befs_off_t        node_off;
+	befs_node *       node;
+	char *           end;
+	char *           buf = (char *) io->buf;
+	char *           name;
+	int              len;
+	int              total = 0;
+	int              key;
+	int              err = 0;
+
+	sd = (befs_small_data *) inode->u.befs_i.i_small_data;
+	end = inode->u.befs_i.i_small_data + inode->u.befs_i.i_small_size;
+
+	for (; sd && (char *) sd < end; sd = BEFS_SD_NEXT(sd)) {
+		len = sd->name_size;
+
+		if (io->size) {
+			if (total + len + 1 > io->size)
+				return -ERANGE;
+			if (copy_to_user (buf + total, BEFS_SD_NAME(sd), len)
+				|| put_user (0, buf + total + len))
+				return -EFAULT;
+		}
+		total += len + 1;
+	}
+
+	dir = befs_attr_dir (inode);
+	if (!dir)
+		return total;
+
+	if (befs_read_index_header (dir, &entry)
+		|| befs_first_leaf (dir, &entry, &node_off)) {
+		iput (dir);
+		return -EIO;
+	}
+
+	while (!err && node_off != BEFS_BT_NULL) {
+		node = befs_get_node (dir, node_off);
+		if (!node) {
+			err = -EIO;
+			break;
+		}
+
+		for (key = 0; key < node->all_key_count; key++) {
+			name = BEFS_NODE_KEY(node, key, len);
+			if (name[0] == '.' && (len == 1
+				|| (len == 2 && name[1] == '.')))
+				continue;
+
+			if (io->size) {
+				if (total + len + 1 > io->size) {
+					err = -ERANGE;
+					break;
+				}
+				if (copy_to_user (buf + total, name, len)
+					|| put_user (0, buf + total + len)) {
+					err = -EFAULT;
+					break;
+				}
+			}
+			total += len + 1;
+		}
+
+		node_off = node->right;
+		befs_put_node (node);
+	}
+
+	iput (dir);
+
+	return err ? err : total;
+}
@@ -0,0 +1,212 @@
+/*
+ *  linux/fs/befs/bulkstat.c
+ *
+ * Copyright (C) 1999  Makoto Kato (m_kato@ga2.so-net.ne.jp)
+ *
+ *  Bulk stat of BEFS.  Blocks of each allocation group are read in order
+ *  on disk, and inode blocks among them are decoded without iget.
+ */
+
+#include <asm/uaccess.h>
+
+#include <linux/errno.h>
+#include <linux/fs.h>
+#include <linux/befs_fs.h>
+#include <linux/sched.h>
+#include <linux/stat.h>
+#include <linux/locks.h>
+#include <linux/malloc.h>
+
+
+/*
+ *  BEFS_BULK_BATCH ... number of blocks in one read request
+ *  BEFS_BULK_MAX   ... max number of blocks scanned in one call
+ */
+
+#define BEFS_BULK_BATCH 64
+#define BEFS_BULK_MAX   8192
+
+
+/*
+ * befs_bulk_decode
+ *
+ * description:
+ *  Fill stat record if block is inode in use.
+ *
+ * return value:
+ *  1 ... block is inode
+ *  0 ... not inode
+ */
+
+static int befs_bulk_decode (struct super_block * sb, befs_off_t block,
+	befs_inode * disk_inode, befs_query_rec * rec)
+{
+	befs_inode_addr iaddr;
+	int            fstype = BEFS_TYPE(sb);
+	__u32          flags;
+
+	if (befs32_to_cpu(fstype, disk_inode->magic1) != BEFS_INODE_MAGIC1)
+		return 0;
+
+	flags = befs32_to_cpu(fstype, disk_inode->flags);
+	if (!(flags & BEFS_INODE_IN_USE) || (flags & BEFS_INODE_DELETED))
+		return 0;
+
+	/*
+	 * Copy of inode block in log has inode number of other block.
+	 */
+
+	befs_convert_inodeaddr (fstype, &disk_inode->inode_num, &iaddr);
+	if (BEFS_IADDR2INO(&iaddr, &sb->u.befs_sb) != block)
+		return 0;
+
+	befs_convert_inodeaddr (fstype, &disk_inode->parent, &iaddr);
+
+	rec->ino = block;
+	rec->parent = BEFS_IADDR2INO(&iaddr, &sb->u.befs_sb);
+	rec->mode = befs32_to_cpu(fstype, disk_inode->mode);
+	rec->uid = sb->u.befs_sb.mount_opts.uid ?
+		sb->u.befs_sb.mount_opts.uid
+		: befs32_to_cpu(fstype, disk_inode->uid);
+	rec->gid = sb->u.befs_sb.mount_opts.gid ?
+		sb->u.befs_sb.mount_opts.gid
+		: befs32_to_cpu(fstype, disk_inode->gid);
+	rec->mtime = (__u32) (befs64_to_cpu(fstype,
+		disk_inode->last_modified_time) >> 16);
+
+	if (S_ISLNK(rec->mode))
+		rec->size = 0;
+	else
+		rec->size = befs64_to_cpu(fstype,
+			disk_inode->data.datastream.size);
+
+	return 1;
+}
+
+
+/*
+ * befs_bulkstat
+ *
+ * description:
+ *  BEFS_IOC_BULKSTAT.  Read blocks from pos up to end of volume, and fill
+ *  records of inodes in them.  Each allocation group is read from its
+ *  first block up to blocks which its bitmap covers, BEFS_BULK_BATCH
+ *  blocks in one request.
+ *
+ * return value:
+ *  number of records
+ */
+
+int befs_bulkstat (struct super_block * sb, befs_bulkstat_io * io)
+{
+	struct buffer_head ** bhs;
+	befs_query_rec       rec;
+	befs_off_t            ag_blocks;
+	befs_off_t            start;
+	befs_off_t            end;
+	befs_off_t            block;
+	befs_off_t            next;
+	__u32                ag;
+	int                  block_size = sb->s_blocksize;
+	int                  scanned = 0;
+	int                  n = 0;
+	int                  nr;
+	int                  i;
+	int                  err = 0;
+
+	if (io->count < 0)
+		return -EINVAL;
+	if (io->pos == BEFS_BT_NULL)
+		return 0;
+	if (io->pos < 0)
+		return -EINVAL;
+
+	/*
+	 * Allocation group is 1 << ag_shift blocks, but only blocks which
+	 * its bitmap blocks cover are used.
+	 */
+
+	ag_blocks = (befs_off_t) 1 << sb->u.befs_sb.ag_shift;
+	if (ag_blocks > (befs_off_t) sb->u.befs_sb.blocks_per_ag
+		* block_size * 8)
+		ag_blocks = (befs_off_t) sb->u.befs_sb.blocks_per_ag
+			* block_size * 8;
+
+	bhs = (struct buffer_head **) kmalloc (BEFS_BULK_BATCH
+		* sizeof(struct buffer_head *), GFP_KERNEL);
+	if (!bhs)
+		return -ENOMEM;
+	BEFS_STAT_ALLOC(sb, BEFS_ST_READ_INODE);
+
+	block = io->pos;
+	while (!err && n < io->count && scanned < BEFS_BULK_MAX) {
+		ag = (__u32) (block >> sb->u.befs_sb.ag_shift);
+		if (ag >= sb->u.befs_sb.num_ags) {
+			block = BEFS_BT_NULL;
+			break;
+		}
+
+		start = (befs_off_t) ag << sb->u.befs_sb.ag_shift;
+		end = start + ag_blocks;
+		if (end > sb->u.befs_sb.num_blocks)
+			end = sb->u.befs_sb.num_blocks;
+
+		if (block >= end) {
+			block = start
+				+ ((befs_off_t) 1 << sb->u.befs_sb.ag_shift);
+			continue;
+		}
+
+		nr = BEFS_BULK_BATCH;
+		if (nr > end - block)
+			nr = end - block;
+
+		for (i = 0; i < nr; i++)
+			bhs[i] = getblk (sb->s_dev, block + i, block_size);
+
+		ll_rw_block (READ, nr, bhs);
+		BEFS_STAT_BREAD(sb, BEFS_ST_READ_INODE, nr);
+
+		/*
+		 * Continue after the last block checked.
+		 */
+
+		next = block;
+		for (i = 0; i < nr; i++) {
+			wait_on_buffer (bhs[i]);
+
+			if (!err && n < io->count) {
+				if (!buffer_uptodate (bhs[i])) {
+					printk (KERN_ERR "BEFS: cannot read "
+						"block - block = %Ld\n",
+						block + i);
+					err = -EIO;
+				} else if (befs_bulk_decode (sb, block + i,
+					(befs_inode *) bhs[i]->b_data, &rec)) {
+
+					if (copy_to_user (io->rec + n, &rec,
+						sizeof(rec)))
+						err = -EFAULT;
+					else
+						n++;
+				}
+
+				if (!err)
+					next = block + i + 1;
+			}
+			brelse (bhs[i]);
+		}
+
+		scanned += next - block;
+		block = next;
+	}
+
+	kfree (bhs);
+
+	if (err && !n)
+		return err;
+
+	io->pos = block;
+
+	return n;
+}
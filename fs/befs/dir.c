@@ -19,6 +19,26 @@
 #include <linux/stat.h>
 #include <linux/mm.h>
 #include <linux/nls.h>
+#include <linux/malloc.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+
+
+/*
+ * Name filter (Bloom filter) of directory
+ *
+ *  BEFS_BLOOM_HASHES    ... number of bits per key
+ *  BEFS_BLOOM_MIN_BITS  ... min size of filter
+ *  BEFS_BLOOM_MAX_BYTES ... max size of filter
+ */
+
+#define BEFS_BLOOM_HASHES    4
+#define BEFS_BLOOM_MIN_BITS  256
+#define BEFS_BLOOM_MAX_BYTES (64 * 1024)
+#define BEFS_BLOOM_WORD_BITS (sizeof(unsigned long) * 8)
+
+static spinlock_t befs_bloom_lock = SPIN_LOCK_UNLOCKED;
+int               befs_bloom_bytes = 0;
 
 
 static ssize_t befs_dir_read (struct file * filp, char * buf, size_t count,
@@ -30,17 +50,29 @@ static ssize_t befs_dir_read (struct file * filp, char * buf, size_t count,
 
 static int befs_readdir(struct file *, void *, filldir_t);
 
+
+/*
+ * Query of root directory is kept in file.
+ */
+
+static int befs_dir_release (struct inode * inode, struct file * filp)
+{
+	befs_query_release (filp);
+
+	return 0;
+}
+
 static struct file_operations befs_dir_operations = {
 	NULL,			/* lseek - default */
 	befs_dir_read,		/* read */
 	NULL,			/* write - bad */
 	befs_readdir,		/* readdir */
 	NULL,			/* poll - default */
-	NULL,			/* ioctl */
+	befs_ioctl,		/* ioctl */
 	NULL,			/* mmap */
 	NULL,			/* no special open code */
 	NULL,			/* flush */
-	NULL,			/* no special release code */
+	befs_dir_release,	/* release */
 	file_fsync,		/* fsync */
 	NULL,			/* fasync */
 	NULL,			/* check_media_change */
@@ -78,6 +110,168 @@ struct inode_operations befs_dir_inode_operations = {
 };
 
 
+/*
+ * befs_bloom_hash
+ *
+ *  FNV-1a hash of key.
+ */
+
+static __u32 befs_bloom_hash (const char * name, int len)
+{
+	__u32 hash = 2166136261UL;
+
+	while (len-- > 0) {
+		hash ^= (unsigned char) *name++;
+		hash *= 16777619;
+	}
+
+	return hash;
+}
+
+
+static void befs_bloom_add (befs_bloom * bloom, const char * name, int len)
+{
+	__u32 h1 = befs_bloom_hash (name, len);
+	__u32 h2 = ((h1 >> 17) | (h1 << 15)) | 1;
+	__u32 bit;
+	int   i;
+
+	for (i = 0; i < BEFS_BLOOM_HASHES; i++) {
+		bit = h1 & (bloom->bits - 1);
+		bloom->map[bit / BEFS_BLOOM_WORD_BITS] |=
+			1UL << (bit % BEFS_BLOOM_WORD_BITS);
+		h1 += h2;
+	}
+}
+
+
+/*
+ * befs_bloom_test
+ *
+ * description:
+ *  Test name by name filter of directory.
+ *
+ * return value:
+ *  0 ... name doesn't exist in directory
+ *  1 ... name may exist, or directory has no complete name filter
+ */
+
+int befs_bloom_test (struct inode * dir, const char * name, int len)
+{
+	befs_bloom * bloom = dir->u.befs_i.i_bloom;
+	__u32       h1;
+	__u32       h2;
+	__u32       bit;
+	int         i;
+
+	if (!bloom || !bloom->complete)
+		return 1;
+
+	h1 = befs_bloom_hash (name, len);
+	h2 = ((h1 >> 17) | (h1 << 15)) | 1;
+
+	for (i = 0; i < BEFS_BLOOM_HASHES; i++) {
+		bit = h1 & (bloom->bits - 1);
+		if (!(bloom->map[bit / BEFS_BLOOM_WORD_BITS]
+			& (1UL << (bit % BEFS_BLOOM_WORD_BITS))))
+			return 0;
+		h1 += h2;
+	}
+
+	return 1;
+}
+
+
+/*
+ * befs_bloom_start
+ *
+ * description:
+ *  Get name filter to build by readdir.  The name filter is built while
+ *  one file reads the whole directory from the top to the end.  If it
+ *  seeks, the name filter is not built.
+ *
+ * return value:
+ *  name filter to add keys, or NULL.
+ */
+
+static befs_bloom * befs_bloom_start (struct inode * dir, struct file * filp)
+{
+	befs_bloom * bloom;
+	befs_bloom * new;
+	int         bits;
+	int         size;
+
+	bloom = dir->u.befs_i.i_bloom;
+	if (bloom && bloom->complete)
+		return NULL;
+
+	if (filp->f_pos) {
+		if (bloom && bloom->owner == filp
+			&& bloom->next == filp->f_pos)
+			return bloom;
+
+		return NULL;
+	}
+
+	if (!bloom) {
+
+		/*
+		 * About 8 bits per key.
+		 */
+
+		for (bits = BEFS_BLOOM_MIN_BITS; bits < dir->i_size / 4
+			&& bits < BEFS_BLOOM_MAX_BYTES * 8; bits <<= 1)
+			;
+		size = sizeof(befs_bloom) + bits / 8;
+
+		new = (befs_bloom *) kmalloc (size, GFP_KERNEL);
+		if (!new)
+			return NULL;
+		BEFS_STAT_ALLOC(dir->i_sb, BEFS_ST_READDIR);
+
+		new->bits = bits;
+		new->size = size;
+		new->complete = 0;
+
+		spin_lock (&befs_bloom_lock);
+		bloom = dir->u.befs_i.i_bloom;
+		if (!bloom) {
+			dir->u.befs_i.i_bloom = bloom = new;
+			befs_bloom_bytes += size;
+			new = NULL;
+		}
+		spin_unlock (&befs_bloom_lock);
+
+		if (new)
+			kfree (new);
+		if (bloom->complete)
+			return NULL;
+	}
+
+	memset (bloom->map, 0, bloom->bits / 8);
+	bloom->owner = filp;
+	bloom->next = 0;
+
+	return bloom;
+}
+
+
+void befs_put_bloom (struct inode * dir)
+{
+	befs_bloom * bloom;
+
+	spin_lock (&befs_bloom_lock);
+	bloom = dir->u.befs_i.i_bloom;
+	dir->u.befs_i.i_bloom = NULL;
+	if (bloom)
+		befs_bloom_bytes -= bloom->size;
+	spin_unlock (&befs_bloom_lock);
+
+	if (bloom)
+		kfree (bloom);
+}
+
+
 /*
  * description:
  *  A directry structure of BEFS become index structure.
@@ -102,137 +296,154 @@ static int befs_readdir(struct file * filp, void * dirent, filldir_t filldir)
 {
 	struct inode *       inode = filp->f_dentry->d_inode;
 	struct super_block * sb = inode->i_sb;
-	befs_inode_addr       iaddr;
-	char *               tmpname;
-	int                  error;
-	int                  count = 0;
+	befs_index_entry      entry;
+	befs_off_t            node_off;
+	befs_bloom *          bloom;
+	char                 nlsname[BEFS_NAME_LEN + 1];
+	cycles_t             start;
+	int                  error = 0;
+	int                  full = 0;
 	int                  len;
-	befs_data_stream *    ds;
-	int                  pos = 0;
+	int                  key;
 
 	BEFS_OUTPUT (("---> befs_readdir() "
-		"inode %ld filp->f_pos %lu\n",
+		"inode %ld filp->f_pos %Ld\n",
 		inode->i_ino, filp->f_pos));
 
 	if (!inode || !S_ISDIR(inode->i_mode) || S_ISLNK(inode->i_mode))
 		return -EBADF;
 
-	tmpname = (char *) __getname();
-	if (!tmpname)
-		return -ENOMEM;
+	if (filp->f_pos >= inode->i_size)
+		return 0;
+
+	start = BEFS_STAT_START();
 
-	ds = &inode->u.befs_i.i_data.ds;
+	if (befs_read_index_header (inode, &entry))
+		return -EBADF;
 
-	while (pos >= 0) {
+	/*
+	 * filp->f_pos is offset of leaf node plus key position in it.
+	 * At first, descend to the leftmost leaf node.
+	 */
 
-		struct buffer_head * bh;
-		befs_index_node *     bn;
-		befs_index_node *     node;
-		befs_off_t            value;
-		int                  flags;
-		int                  k;
-		befs_off_t            offset;
-		char *               tmpname2;
+	bloom = befs_bloom_start (inode, filp);
+
+	node_off = filp->f_pos & ~((befs_off_t) entry.node_size - 1);
+	key = filp->f_pos & (entry.node_size - 1);
+	if (!node_off) {
+		if (befs_first_leaf (inode, &entry, &node_off))
+			return -EBADF;
+		key = 0;
+		filp->f_pos = node_off;
+	}
+
+	while (node_off > 0 && node_off < inode->i_size) {
+		befs_node *           node;
+		char *               name;
 		int                  len_dist;
-		
-		if (pos)
-			flags = 1;
-		else
-			flags = 0;
-
-		iaddr = befs_read_data_stream (sb, ds, &pos);
-		if (!pos || BEFS_IS_EMPTY_IADDR(&iaddr))
-			break;
 
 		/*
-		 * read index node
+		 * get leaf node
 		 */
 
-		bh = befs_read_index_node (iaddr, sb, flags, &offset);
-		if (!bh)
-			return -EBADF;
-
-		bn = (befs_index_node *) (bh->b_data + offset);
-#ifdef CONFIG_BEFS_CONV
-		node = (befs_index_node *) __getname();
+		node = befs_get_node (inode, node_off);
 		if (!node) {
-			brelse (bh);
-			return -ENOMEM;
+			error = -EBADF;
+			break;
 		}
 
-		befs_convert_index_node (BEFS_TYPE(sb), bn, node);
-#else
-		node = bn;
-#endif
-		BEFS_DUMP_INDEX_NODE (node);
+		if (node->overflow != BEFS_BT_NULL) {
+			printk (KERN_ERR "BEFS: not leaf node in leaf chain - "
+				"inode = %lu\n", inode->i_ino);
+			befs_put_node (node);
+			error = -EBADF;
+			break;
+		}
 
 		/*
-		 * Is there no directry key in this index node?
+		 * Read next leaf node while this leaf node is decoded.
 		 */
 
-		if (node->all_key_count + count <= filp->f_pos) {
+		if (node->right != BEFS_BT_NULL)
+			befs_prefetch_stream (inode, node->right);
 
-			/*
-			 * Not exist
-			 */
+		for (; key < node->all_key_count; key++) {
+			name = BEFS_NODE_KEY(node, key, len);
 
-			count += node->all_key_count;
-#ifdef CONFIG_BEFS_CONV
-			putname (node);
-#endif
-			putname (node);
-			brelse (bh);
-			continue;
-		}
+			if (BEFS_NAME_PASSTHROUGH(sb)) {
+				full = filldir (dirent, name, len,
+					filp->f_pos, (ino_t) node->value[key]);
+			} else {
 
-#ifdef CONFIG_BEFS_CONV
-		putname (node);
-#endif
-		k = filp->f_pos - count;
+				/*
+				 * Convert UTF-8 to nls charset
+				 */
 
-		/*
-		 * search key
-		 */
+				len_dist = befs_utf2nls (name, len, nlsname,
+					sizeof(nlsname), sb);
+				if (len_dist < 0) {
+					error = len_dist;
+					break;
+				}
+				full = filldir (dirent, nlsname, len_dist,
+					filp->f_pos, (ino_t) node->value[key]);
+			}
 
-		if (!befs_get_key_from_index_node (bn, &k, BEFS_TYPE(sb),
-			tmpname, &len, &value)) {
+			if (full) {
 
-			putname (tmpname);
-			brelse (bh);
+				/*
+				 * buffer of filldir is full.
+				 */
 
-			return -EBADF;
+				break;
+			}
+
+			if (bloom)
+				befs_bloom_add (bloom, name, len);
+
+			filp->f_pos = node_off + key + 1;
 		}
 
 		/*
-		 * Convert UTF-8 to nls charset
+		 * go to right leaf node.
 		 */
 
-		if (!befs_utf2nls (tmpname, len, &tmpname2, &len_dist, sb)) {
-			putname (tmpname);
-			brelse (bh);
+		node_off = node->right;
+		befs_put_node (node);
+
+		if (error || full)
+			break;
 
-			return -ENOMEM;
+		key = 0;
+		if (node_off == BEFS_BT_NULL) {
+
+			/*
+			 * end of directory
+			 */
+
+			filp->f_pos = inode->i_size;
+			break;
 		}
-		error = filldir (dirent, tmpname2, len_dist, filp->f_pos,
-			(ino_t) value);
-		putname (tmpname2);
+		filp->f_pos = node_off;
+	}
 
-		if (error)
-			filp->f_pos = 0;
-		else
-			filp->f_pos++;
+	if (bloom) {
+		bloom->next = filp->f_pos;
 
-		brelse (bh);
+		if (!error && filp->f_pos >= inode->i_size) {
+			bloom->complete = 1;
 
-		goto finish;
+			BEFS_OUTPUT ((" name filter of inode %lu, "
+				"%d bytes (total %d bytes)\n", inode->i_ino,
+				bloom->size, befs_bloom_bytes));
+		}
 	}
 
-	filp->f_pos = 0;
-finish:
-	putname (tmpname);
+	befs_stat_end (sb, BEFS_ST_READDIR, start);
+	BEFS_TRACE(BEFS_ST_READDIR, inode->i_ino, NULL, start);
 
-	BEFS_OUTPUT (("<--- befs_readdir() filp->f_pos %d\n",
+	BEFS_OUTPUT (("<--- befs_readdir() filp->f_pos %Ld\n",
 		filp->f_pos));
-		
-	return 0;
+
+	return error;
 }
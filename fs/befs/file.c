@@ -22,15 +22,82 @@
 #include <linux/locks.h>
 #include <linux/mm.h>
 #include <linux/pagemap.h>
+#include <linux/malloc.h>
+#include <linux/spinlock.h>
 
 
-ssize_t befs_file_read (struct file *, char *,  size_t, loff_t *);
-static befs_inode_addr befs_startpos_from_ds (struct super_block *,
-	befs_data_stream *, off_t);
+/*
+ * Cursor of befs_read_data_stream
+ */
+
+#define BEFS_DS_DIRECT   0
+#define BEFS_DS_INDIRECT 1
+#define BEFS_DS_DOUBLE   2
+
+#define BEFS_DS_SHIFT    28
+#define BEFS_DS_POS(sect, idx) (((sect) << BEFS_DS_SHIFT) | (idx))
+#define BEFS_DS_SECT(pos)      ((pos) >> BEFS_DS_SHIFT)
+#define BEFS_DS_INDEX(pos)     ((pos) & ((1 << BEFS_DS_SHIFT) - 1))
+
+/*
+ * Max size of decoded indirect block kept in inode.  Larger indirect block
+ * is read block by block.
+ */
+
+#define BEFS_INDIRECT_MAP_MAX 32768
+
+/*
+ * Layout of double-indirect block in extent map
+ *
+ *  BEFS_DOUBLE_UNKNOWN ... not checked yet
+ *  BEFS_DOUBLE_FIXED   ... every block run is BEFS_DBLINDIR_BRUN_LEN blocks
+ *  BEFS_DOUBLE_WALK    ... not fixed-size, so block runs are walked
+ */
+
+#define BEFS_DOUBLE_UNKNOWN 0
+#define BEFS_DOUBLE_FIXED   1
+#define BEFS_DOUBLE_WALK    2
+
+/*
+ * Initial number of extents in extent map
+ */
+
+#define BEFS_EXTENT_MAP_MIN 16
+#define BEFS_EXTENT_MAP_SIZE(n) \
+	(sizeof(befs_extent_map) + ((n) - 1) * sizeof(befs_extent))
+
+/*
+ * Large read is submitted by block runs.
+ *
+ *  BEFS_READ_BATCH      ... max number of blocks in one request
+ *  BEFS_READ_STREAM_MIN ... min number of blocks of read to bypass page cache
+ *
+ * Large read does no readahead, and its blocks are kept only in buffer
+ * cache, not in page cache.
+ */
+
+#define BEFS_READ_BATCH      64
+#define BEFS_READ_STREAM_MIN 8
+
+/*
+ * Page cache is used only if a block is not larger than a page.  Volume
+ * of 8192 bytes blocks is always read by the copy path.
+ */
+
+#define BEFS_PAGE_CACHE(sb) ((sb)->s_blocksize <= PAGE_SIZE)
+
+static spinlock_t befs_extent_lock = SPIN_LOCK_UNLOCKED;
+
+
+static ssize_t befs_file_read (struct file *, char *, size_t, loff_t *);
+static int befs_file_mmap (struct file *, struct vm_area_struct *);
+static befs_inode_addr befs_startpos_from_ds (struct inode *, loff_t);
 static int befs_read_indirect_block (struct super_block *, const befs_inode_addr,
 	const int, befs_inode_addr *);
+static befs_block_run * befs_get_indirect_map (struct inode *);
 static int befs_read_double_indirect_block (struct super_block *,
 	const befs_inode_addr, const int, befs_inode_addr *);
+static befs_inode_addr befs_next_run (struct inode *, int *, int);
 static ssize_t befs_file_write (struct file *, const char *, size_t, loff_t *);
 
 
@@ -41,8 +108,8 @@ static struct file_operations befs_file_ops =
 	NULL,				/* write */
 	NULL,				/* readdir - bad */
 	NULL,				/* poll - default */
-	NULL,				/* ioctl - default */
-	generic_file_mmap,		/* mmap */
+	befs_ioctl,			/* ioctl */
+	befs_file_mmap,			/* mmap */
 	NULL,
 	NULL,				/* flush */
 	NULL,				/* release */
@@ -63,7 +130,7 @@ struct inode_operations befs_file_inode_operations =
 	NULL,				/* rename */
 	NULL,				/* readlink */
 	NULL,				/* follow_link */
-	NULL,				/* get_block */
+	befs_get_block,			/* get_block */
 	block_read_full_page,		/* readpage */
 	NULL,				/* writepage */
 	NULL,				/* flushpage */
@@ -74,92 +141,212 @@ struct inode_operations befs_file_inode_operations =
 };
 
 
-ssize_t befs_file_read(struct file *filp, char *buf,  size_t count, loff_t *ppos)
+/*
+ * befs_file_mmap
+ *
+ * description:
+ *  block_read_full_page cannot read a block larger than a page, so files
+ *  of such a volume are not mapped.
+ */
+
+static int befs_file_mmap (struct file * filp, struct vm_area_struct * vma)
+{
+	if (!BEFS_PAGE_CACHE(filp->f_dentry->d_inode->i_sb))
+		return -ENODEV;
+
+	return generic_file_mmap (filp, vma);
+}
+
+
+/*
+ * befs_file_read
+ *
+ * description:
+ *  Read file.  Small read or read of mapped file is done through page
+ *  cache.  Large read is submitted as one request per block run (and
+ *  physically adjacent block runs), because BFS file is mostly long
+ *  contiguous block runs.
+ */
+
+static ssize_t befs_file_read (struct file * filp, char * buf, size_t count,
+	loff_t * ppos)
 {
 	struct inode *       inode = filp->f_dentry->d_inode;
 	struct super_block * sb = inode->i_sb;
-	befs_data_stream *    ds = &inode->u.befs_i.i_data.ds;
+	struct buffer_head ** bhs;
 	befs_inode_addr       iaddr;
-	befs_inode_addr       iaddr2;
-	off_t                pos = *ppos;
-	off_t                sum = 0;
+	befs_inode_addr       next;
+	loff_t               pos = *ppos;
+	ssize_t              read_count = 0;
+	unsigned long        blocks;
+	unsigned long        block;
+	int                  block_size = sb->u.befs_sb.block_size;
+	int                  block_shift = sb->u.befs_sb.block_shift;
+	int                  offset;
+	int                  len;
+	int                  nr;
 	int                  i;
-	int                  j;
-	off_t                read_count;
-	off_t                offset;
+	int                  err = 0;
+	cycles_t             start = BEFS_STAT_START();
+
+	if (BEFS_PAGE_CACHE(sb) && (inode->i_mmap
+		|| count < (BEFS_READ_STREAM_MIN << block_shift))) {
+		read_count = generic_file_read (filp, buf, count, ppos);
+		goto out;
+	}
 
 	BEFS_OUTPUT (("---> befs_file_read() "
 		"inode %lu count %lu ppos %Lu\n",
 		inode->i_ino, (__u32) count, *ppos));
 
-	/*
-	 * Get start position
-	 */
+	if (pos >= inode->i_size)
+		goto out;
+
+	if (count > inode->i_size - pos)
+		count = inode->i_size - pos;
+
+	bhs = (struct buffer_head **) kmalloc (BEFS_READ_BATCH
+		* sizeof(struct buffer_head *), GFP_KERNEL);
+	if (!bhs) {
+		read_count = -ENOMEM;
+		goto out;
+	}
+	BEFS_STAT_ALLOC(sb, BEFS_ST_FILE_READ);
 
-	for (i = 0; ;) {
-		iaddr = befs_read_data_stream (sb, ds, &i);
+	while (count > 0) {
+		iaddr = befs_startpos_from_ds (inode, pos);
 		if (BEFS_IS_EMPTY_IADDR(&iaddr)) {
 			BEFS_OUTPUT ((" end data_stream\n"));
 			break;
 		}
 
-		if ((pos >= sum)
-			&& (pos < sum + iaddr.len * sb->u.befs_sb.block_size)) {
+		offset = pos & (block_size - 1);
+		blocks = (offset + count + block_size - 1) >> block_shift;
 
-			iaddr.start += (pos - sum) / sb->u.befs_sb.block_size;
-			iaddr.len -= (pos - sum) / sb->u.befs_sb.block_size;
-			break;
-		}
-		sum += iaddr.len * sb->u.befs_sb.block_size;
-	}
+		/*
+		 * Collect blocks from this block run.  If next block run
+		 * is physically adjacent, continue to it.
+		 */
 
-	read_count = 0;
-	offset = (pos - sum) % sb->u.befs_sb.block_size;
-	iaddr2 = iaddr;
+		nr = 0;
+		block = BEFS_IADDR2INO(&iaddr, &sb->u.befs_sb);
+		while (nr < blocks && nr < BEFS_READ_BATCH) {
+			bhs[nr++] = getblk (sb->s_dev, block++, block_size);
 
-	count = inode->i_size > pos + count ? count : inode->i_size - pos;
+			if (--iaddr.len)
+				continue;
 
-	for ( j = 0; j < iaddr.len; j++) {
-		struct buffer_head * bh;
+			next = befs_startpos_from_ds (inode,
+				pos - offset + (((loff_t) nr) << block_shift));
+			if (BEFS_IS_EMPTY_IADDR(&next)
+				|| BEFS_IADDR2INO(&next, &sb->u.befs_sb) != block)
+				break;
+			iaddr = next;
+		}
 
-		bh = befs_bread2 (sb, iaddr2);
-		if (!bh)
-			return -EBADF;
+		BEFS_OUTPUT ((" submit %d blocks from %lu\n", nr, block - nr));
 
-		BEFS_OUTPUT ((" read_count %Ld offset %Ld\n",
-			read_count, offset));
+		ll_rw_block (READ, nr, bhs);
+		BEFS_STAT_BREAD(sb, BEFS_ST_FILE_READ, nr);
 
-		if (count > sb->u.befs_sb.block_size) {
-			memcpy (buf + read_count, bh->b_data + offset,
-				sb->u.befs_sb.block_size - offset);
+		for (i = 0; i < nr; i++) {
+			wait_on_buffer (bhs[i]);
+			if (!buffer_uptodate (bhs[i])) {
+				err = -EIO;
+				break;
+			}
 
-			*ppos += sb->u.befs_sb.block_size - offset;
-			count -= sb->u.befs_sb.block_size - offset;
-			read_count += sb->u.befs_sb.block_size - offset;
-			offset = 0;
+			len = block_size - offset;
+			if (len > count)
+				len = count;
 
-			++iaddr2.start;
+			if (copy_to_user (buf + read_count,
+				bhs[i]->b_data + offset, len)) {
+				err = -EFAULT;
+				break;
+			}
+			brelse (bhs[i]);
+
+			pos += len;
+			count -= len;
+			read_count += len;
+			offset = 0;
+		}
 
-			brelse (bh);
-		} else {
-			memcpy (buf + read_count, bh->b_data + offset, count);
+		if (err) {
+			while (i < nr)
+				brelse (bhs[i++]);
 
-			*ppos += count;
-			read_count += count;
-	
-			brelse (bh);
+			if (!read_count)
+				read_count = err;
 			break;
 		}
 	}
 
-	ppos += read_count;
+	kfree (bhs);
+
+	if (read_count > 0)
+		*ppos = pos;
+
+out:
+	befs_stat_end (sb, BEFS_ST_FILE_READ, start);
+	BEFS_TRACE(BEFS_ST_FILE_READ, inode->i_ino, NULL, start);
 
 	BEFS_OUTPUT (("<--- befs_file_read() "
-		"return value %d, ppos %ld\n", read_count, *ppos));
+		"return value %d, ppos %Ld\n", read_count, *ppos));
 
 	return read_count;
 }
 
+
+/*
+ * befs_get_block
+ *
+ * description:
+ *  Map block of file to block of device for page cache.
+ *
+ * parameter:
+ *  inode     ... inode of file
+ *  iblock    ... block number in file
+ *  bh_result ... buffer head to map
+ *  create    ... BFS is read-only, so must be 0
+ *
+ * return value:
+ *  0 ... sucess.  If iblock is out of data stream, bh_result is not mapped.
+ */
+
+int befs_get_block (struct inode * inode, long iblock,
+	struct buffer_head * bh_result, int create)
+{
+	struct super_block * sb = inode->i_sb;
+	befs_inode_addr       iaddr;
+
+	BEFS_OUTPUT (("---> befs_get_block() inode %lu block %ld\n",
+		inode->i_ino, iblock));
+
+	if (create)
+		return -EROFS;
+
+	if (iblock < 0)
+		return -EIO;
+
+	iaddr = befs_startpos_from_ds (inode,
+		((loff_t) iblock) << sb->u.befs_sb.block_shift);
+	if (BEFS_IS_EMPTY_IADDR(&iaddr)) {
+		BEFS_OUTPUT (("<--- befs_get_block() out of data stream\n"));
+		return 0;
+	}
+
+	bh_result->b_dev = inode->i_dev;
+	bh_result->b_blocknr = BEFS_IADDR2INO(&iaddr, &sb->u.befs_sb);
+	bh_result->b_state |= (1UL << BH_Mapped);
+
+	BEFS_OUTPUT (("<--- befs_get_block() block %lu\n",
+		bh_result->b_blocknr));
+
+	return 0;
+}
+
 /*
  * Read indirect block
  */
@@ -171,6 +358,7 @@ static int befs_read_indirect_block (struct super_block * sb,
 	befs_inode_addr *     array;
 	struct buffer_head * bh;
 	befs_inode_addr       addr = indirect;
+	befs_inode_addr       run;
 	int                  p = pos;
 
 	BEFS_OUTPUT (("---> befs_read_indirect_block()\n"));
@@ -192,13 +380,18 @@ static int befs_read_indirect_block (struct super_block * sb,
 		return -EBADF;
 
 	array = (befs_inode_addr *) bh->b_data;
+#ifdef CONFIG_BEFS_CONV
+	befs_convert_inodeaddr (BEFS_TYPE(sb), &array[p], &run);
+#else
+	run = array[p];
+#endif
 
 	/*
 	 * Is this block inode address??
 	 */
 
-	if (!BEFS_IS_EMPTY_IADDR(&array[p % BEFS_BLOCK_PER_INODE(sb)])) {
-		*iaddr = array[p % BEFS_BLOCK_PER_INODE(sb)];
+	if (!BEFS_IS_EMPTY_IADDR(&run)) {
+		*iaddr = run;
 	} else {
 		brelse (bh);
 		return -EBADF;
@@ -212,22 +405,114 @@ static int befs_read_indirect_block (struct super_block * sb,
 }
 
 /*
- * befs_read_double_indirect_block
+ * befs_get_indirect_map
  *
  * description:
- *  Read double-indirect block
- *
- * parameter:
- *  sb              ... super block
- *  double_indirect ... inode address of double-indirect block
- *  pos             ... position of double-indirect block
- *                       (*pos - max_direct_block - max_indirect_block)
+ *  Return all block runs of indirect block of inode.  They are read and
+ *  converted at first call, and are stored in i_indirect until the inode
+ *  is released.
  *
  * return value:
- *  0 ... sucess
+ *  array of block runs, or NULL if inode has no indirect block, it is
+ *  larger than BEFS_INDIRECT_MAP_MAX or cannot allocate memory.
  */
 
-static int befs_read_double_indirect_block (struct super_block * sb,
+static befs_block_run * befs_get_indirect_map (struct inode * inode)
+{
+	struct super_block * sb = inode->i_sb;
+	befs_inode_addr       addr = BEFS_I_INDIRECT(inode);
+	befs_block_run *      runs;
+	struct buffer_head * bh;
+	int                  per_block = BEFS_BLOCK_PER_INODE(sb);
+	int                  i;
+#ifdef CONFIG_BEFS_CONV
+	int                  j;
+#endif
+
+	runs = inode->u.befs_i.i_indirect;
+	if (runs)
+		return runs;
+
+	if (BEFS_IS_EMPTY_IADDR(&addr)
+		|| addr.len > BEFS_INDIRECT_MAP_MAX / sb->u.befs_sb.block_size)
+		return NULL;
+
+	BEFS_OUTPUT (("---> befs_get_indirect_map() inode %lu "
+		"[%lu, %u, %u]\n", inode->i_ino,
+		addr.allocation_group, addr.start, addr.len));
+
+	runs = kmalloc (addr.len * sb->u.befs_sb.block_size, GFP_KERNEL);
+	if (!runs)
+		return NULL;
+	BEFS_STAT_ALLOC(sb, BEFS_ST_MAP_INDIRECT);
+
+	for (i = 0; i < addr.len; i++) {
+		befs_inode_addr iaddr = addr;
+
+		iaddr.start += i;
+		iaddr.len -= i;
+
+		BEFS_STAT_BREAD(sb, BEFS_ST_MAP_INDIRECT, 1);
+		bh = befs_bread2 (sb, iaddr);
+		if (!bh) {
+			kfree (runs);
+			return NULL;
+		}
+
+#ifdef CONFIG_BEFS_CONV
+		for (j = 0; j < per_block; j++)
+			befs_convert_inodeaddr (BEFS_TYPE(sb),
+				&((befs_block_run *) bh->b_data)[j],
+				&runs[i * per_block + j]);
+#else
+		memcpy (runs + i * per_block, bh->b_data,
+			sb->u.befs_sb.block_size);
+#endif
+		brelse (bh);
+	}
+
+	/*
+	 * Other process may read indirect block while we sleep.
+	 */
+
+	spin_lock (&befs_extent_lock);
+	if (inode->u.befs_i.i_indirect) {
+		spin_unlock (&befs_extent_lock);
+		kfree (runs);
+		return inode->u.befs_i.i_indirect;
+	}
+	inode->u.befs_i.i_indirect = runs;
+	spin_unlock (&befs_extent_lock);
+
+	BEFS_OUTPUT (("<--- befs_get_indirect_map()\n"));
+
+	return runs;
+}
+
+
+void befs_put_indirect_map (struct inode * inode)
+{
+	befs_block_run * runs;
+
+	spin_lock (&befs_extent_lock);
+	runs = inode->u.befs_i.i_indirect;
+	inode->u.befs_i.i_indirect = NULL;
+	spin_unlock (&befs_extent_lock);
+
+	if (runs)
+		kfree (runs);
+}
+
+
+/*
+ * befs_walk_double_indirect_block
+ *
+ * description:
+ *  Read double-indirect block by exploring all indirect block runs.
+ *  This is used when the double-indirect block is not fixed-size layout.
+ */
+
+static int befs_walk_double_indirect_block (struct super_block * sb,
         const befs_inode_addr double_indirect, const int pos,
 	befs_inode_addr * iaddr)
 {
@@ -235,11 +520,13 @@ static int befs_read_double_indirect_block (struct super_block * sb,
         int                   p = pos;
         befs_inode_addr *      indirects;
 	befs_inode_addr        addr = double_indirect;
+	befs_inode_addr        indirect;
 	int                   i;
 
-	BEFS_OUTPUT (("---> befs_read_double_indirect_block() \n"));
+	BEFS_OUTPUT (("---> befs_walk_double_indirect_block() \n"));
 
         while (addr.len) {
+                BEFS_STAT_BREAD(sb, BEFS_ST_MAP_DOUBLE, 1);
                 bh_indirect = befs_bread2 (sb, addr);
 
                 if (!bh_indirect) {
@@ -256,7 +543,13 @@ static int befs_read_double_indirect_block (struct super_block * sb,
                 indirects = (befs_inode_addr *) bh_indirect->b_data;
 
                 for (i = 0; i < BEFS_BLOCK_PER_INODE(sb); i++) {
-                        if (p < indirects[i].len * BEFS_BLOCK_PER_INODE(sb)) {
+#ifdef CONFIG_BEFS_CONV
+			befs_convert_inodeaddr (BEFS_TYPE(sb), &indirects[i],
+				&indirect);
+#else
+			indirect = indirects[i];
+#endif
+                        if (p < indirect.len * BEFS_BLOCK_PER_INODE(sb)) {
 
                                 /*
                                  * find block!
@@ -264,14 +557,15 @@ static int befs_read_double_indirect_block (struct super_block * sb,
 
 				int err;
 
+				BEFS_STAT_BREAD(sb, BEFS_ST_MAP_DOUBLE, 1);
 				err = befs_read_indirect_block (sb,
-					indirects[i], p, iaddr);
+					indirect, p, iaddr);
 				brelse (bh_indirect);
 
 				return err;
                         }
 
-                        p -= indirects[i].len * BEFS_BLOCK_PER_INODE(sb);
+                        p -= indirect.len * BEFS_BLOCK_PER_INODE(sb);
                 }
 
                 brelse(bh_indirect);
@@ -285,106 +579,663 @@ static int befs_read_double_indirect_block (struct super_block * sb,
 }
 
 
-befs_inode_addr befs_read_data_stream (struct super_block * sb,
-	befs_data_stream * ds, int * pos)
+/*
+ * befs_read_double_indirect_block
+ *
+ * description:
+ *  Read double-indirect block
+ *
+ *  BFS makes every indirect block run in double-indirect block with
+ *  BEFS_DBLINDIR_BRUN_LEN blocks, so the position of indirect block run
+ *  can be computed directly.  If the indirect block run is not this
+ *  length, explore double-indirect block.
+ *
+ * parameter:
+ *  sb              ... super block
+ *  double_indirect ... inode address of double-indirect block
+ *  pos             ... position of double-indirect block
+ *                       (*pos - max_direct_block - max_indirect_block)
+ *
+ * return value:
+ *  0 ... sucess
+ */
+
+static int befs_read_double_indirect_block (struct super_block * sb,
+        const befs_inode_addr double_indirect, const int pos,
+	befs_inode_addr * iaddr)
 {
+        struct buffer_head *  bh_indirect;
+	befs_inode_addr        addr = double_indirect;
+	befs_inode_addr        indirect;
+	int                   per_block = BEFS_BLOCK_PER_INODE(sb);
+	int                   per_indirect;
+	int                   i;
+	int                   err;
+
+	BEFS_OUTPUT (("---> befs_read_double_indirect_block() pos %d\n",
+		pos));
+
+	if (pos < 0)
+		return -EBADF;
+
+	/*
+	 * i ... index of indirect block run in double-indirect block
+	 */
+
+	per_indirect = BEFS_DBLINDIR_BRUN_LEN * per_block;
+	i = pos / per_indirect;
+
+	if (i / per_block >= addr.len)
+		return -EBADF;
+
+	addr.start += i / per_block;
+	addr.len -= i / per_block;
+
+	BEFS_STAT_BREAD(sb, BEFS_ST_MAP_DOUBLE, 1);
+	bh_indirect = befs_bread2 (sb, addr);
+	if (!bh_indirect) {
+		BEFS_OUTPUT (("cannot read double-indirect block "
+			"[%lu, %u, %u]\n",
+			addr.allocation_group, addr.start, addr.len));
+		return -EBADF;
+	}
+
+#ifdef CONFIG_BEFS_CONV
+	befs_convert_inodeaddr (BEFS_TYPE(sb),
+		&((befs_inode_addr *) bh_indirect->b_data)[i % per_block],
+		&indirect);
+#else
+	indirect = ((befs_inode_addr *) bh_indirect->b_data)[i % per_block];
+#endif
+	brelse (bh_indirect);
+
+	if (indirect.len != BEFS_DBLINDIR_BRUN_LEN) {
+
+		/*
+		 * not fixed-size layout
+		 */
+
+		BEFS_OUTPUT ((" indirect block run length %u\n",
+			indirect.len));
+
+		return befs_walk_double_indirect_block (sb, double_indirect,
+			pos, iaddr);
+	}
+
+	BEFS_STAT_BREAD(sb, BEFS_ST_MAP_DOUBLE, 1);
+	err = befs_read_indirect_block (sb, indirect, pos % per_indirect,
+		iaddr);
+
+	BEFS_OUTPUT (("<--- befs_read_double_indirect_block() %d\n", err));
+
+	return err;
+}
+
+
+/*
+ * befs_read_data_stream
+ *
+ * description:
+ *  Return the block run at position *pos of data stream, and advance *pos
+ *  to the next block run.  When no more block run exists, return empty
+ *  inode address and set *pos to 0.
+ *
+ *  *pos is a cursor.  Upper bits select direct, indirect or double-indirect
+ *  block and lower bits are the index in it.  Start with *pos = 0.
+ */
+
+befs_inode_addr befs_read_data_stream (struct inode * inode, int * pos)
+{
+	return befs_next_run (inode, pos, BEFS_DS_DOUBLE);
+}
+
+
+/*
+ * befs_next_run
+ *
+ * description:
+ *  befs_read_data_stream which stops after block runs of section last.
+ */
+
+static befs_inode_addr befs_next_run (struct inode * inode, int * pos,
+	int last)
+{
+	struct super_block * sb = inode->i_sb;
+	befs_block_run *      direct = BEFS_I_RUNS(inode);
+	int                  direct_count = inode->u.befs_i.i_direct_count;
+	befs_inode_addr       indirect = direct[direct_count];
+	befs_inode_addr       double_indirect = direct[direct_count + 1];
+	befs_block_run *      runs;
         befs_inode_addr       iaddr = {0, 0, 0};
+	cycles_t             start = BEFS_STAT_START();
+	int                  sect;
+	int                  idx;
 
-	BEFS_OUTPUT (("---> befs_read_data_stream() pos %d\n", *pos));
+	BEFS_OUTPUT (("---> befs_read_data_stream() pos %08x\n", *pos));
 
         if( *pos < 0 )
                 return iaddr;
 
-        if (*pos < ds->max_direct_range) {
+	sect = BEFS_DS_SECT(*pos);
+	idx = BEFS_DS_INDEX(*pos);
+
+        if (sect == BEFS_DS_DIRECT) {
 
 		/*
 		 * This position is in direct block.
 		 */
 
-		BEFS_OUTPUT ((" read in direct block [%lu, %u, %u]\n",
-			ds->direct[*pos].allocation_group,
-			ds->direct[*pos].start, ds->direct[*pos].len));
+		if (idx < direct_count) {
 
-		/*
-		 * Is this block inode address??
-		 */
+			BEFS_OUTPUT ((" read in direct block [%lu, %u, %u]\n",
+				direct[idx].allocation_group,
+				direct[idx].start, direct[idx].len));
+
+			*pos = BEFS_DS_POS(BEFS_DS_DIRECT, idx + 1);
+			befs_stat_end (sb, BEFS_ST_MAP_DIRECT, start);
+			BEFS_TRACE(BEFS_ST_MAP_DIRECT, inode->i_ino,
+				&direct[idx], start);
+			return direct[idx];
+		}
+
+		sect = BEFS_DS_INDIRECT;
+		idx = 0;
+	}
 
-                if (!BEFS_IS_EMPTY_IADDR(&ds->direct[*pos]))
-			iaddr = ds->direct[(*pos)++];
-        } else if (*pos < ds->max_indirect_range + ds->max_direct_range) {
+	if (sect == BEFS_DS_INDIRECT) {
 
 		/*
 		 * This position is in in-direct block.
 		 */
 
-		int  p = *pos - ds->max_direct_range;
-		
 		BEFS_OUTPUT ((" read in indirect block [%lu, %u, %u]\n",
-			ds->indirect.allocation_group, ds->indirect.start,
-			ds->indirect.len));
+			indirect.allocation_group, indirect.start,
+			indirect.len));
+
+		runs = befs_get_indirect_map (inode);
+		if (runs) {
+			if (idx < indirect.len * BEFS_BLOCK_PER_INODE(sb)
+				&& !BEFS_IS_EMPTY_IADDR(&runs[idx])) {
+
+				*pos = BEFS_DS_POS(BEFS_DS_INDIRECT, idx + 1);
+				befs_stat_end (sb, BEFS_ST_MAP_INDIRECT, start);
+				BEFS_TRACE(BEFS_ST_MAP_INDIRECT, inode->i_ino,
+					&runs[idx], start);
+				return runs[idx];
+			}
+		} else if (!BEFS_IS_EMPTY_IADDR(&indirect)) {
+			BEFS_STAT_BREAD(sb, BEFS_ST_MAP_INDIRECT, 1);
+
+			if (!befs_read_indirect_block (sb, indirect, idx,
+				&iaddr)) {
+
+				*pos = BEFS_DS_POS(BEFS_DS_INDIRECT, idx + 1);
+				befs_stat_end (sb, BEFS_ST_MAP_INDIRECT, start);
+				BEFS_TRACE(BEFS_ST_MAP_INDIRECT, inode->i_ino,
+					&iaddr, start);
+				return iaddr;
+			}
+		}
+
+		sect = BEFS_DS_DOUBLE;
+		idx = 0;
+	}
 
-		if (!befs_read_indirect_block (sb, ds->indirect, p, &iaddr))
-			(*pos)++;
-        } else if (*pos < ds->max_double_indirect_range
-		+ ds->max_direct_range + ds->max_indirect_range) {
+	if (sect == BEFS_DS_DOUBLE && sect <= last) {
 
 		/*
 		 * This position is in double-in-direct block.
 		 */
 
-		int  p = *pos - ds->max_direct_range - ds->max_indirect_range;
-
 		BEFS_OUTPUT ((" read in double indirect block\n"));
 
-		if (!befs_read_double_indirect_block (sb, ds->double_indirect,
-			p, &iaddr)) {
+		if (!BEFS_IS_EMPTY_IADDR(&double_indirect)
+			&& !befs_read_double_indirect_block (sb,
+			double_indirect, idx, &iaddr)) {
 
-			(*pos)++;
-		} 
-        }
+			*pos = BEFS_DS_POS(BEFS_DS_DOUBLE, idx + 1);
+			befs_stat_end (sb, BEFS_ST_MAP_DOUBLE, start);
+			BEFS_TRACE(BEFS_ST_MAP_DOUBLE, inode->i_ino, &iaddr,
+				start);
+			return iaddr;
+		}
+	}
 
-	if (BEFS_IS_EMPTY_IADDR(&iaddr))
-		*pos = 0;
+	/*
+	 * end of data stream
+	 */
+
+	iaddr.allocation_group = 0;
+	iaddr.start = 0;
+	iaddr.len = 0;
+	*pos = 0;
 
         return iaddr;
 }
 
+
+/*
+ * befs_find_extent
+ *
+ * description:
+ *  Binary search of block in extent map.
+ *
+ * return value:
+ *  index of extent, or -1 if block is out of data stream.
+ */
+
+static int befs_find_extent (befs_extent_map * map, befs_off_t block)
+{
+	int lo = 0;
+	int hi = map->count - 1;
+	int mid;
+
+	while (lo <= hi) {
+		mid = (lo + hi) >> 1;
+
+		if (block < map->extent[mid].logical)
+			hi = mid - 1;
+		else if (block >= map->extent[mid].logical
+			+ map->extent[mid].run.len)
+			lo = mid + 1;
+		else
+			return mid;
+	}
+
+	return -1;
+}
+
+
+/*
+ * befs_get_extent_map
+ *
+ * description:
+ *  Return extent map of data stream of inode.  Extent map is made from
+ *  data stream at first call, and is stored in i_index_cache until the
+ *  inode is released.  Extent map has direct and indirect block runs only.
+ *
+ * return value:
+ *  extent map, or NULL if cannot allocate memory.
+ */
+
+befs_extent_map * befs_get_extent_map (struct inode * inode)
+{
+	befs_extent_map *     map;
+	befs_extent_map *     new;
+	befs_inode_addr       iaddr;
+	befs_off_t            logical = 0;
+	int                  size = BEFS_EXTENT_MAP_MIN;
+	int                  i = 0;
+
+	map = (befs_extent_map *) inode->u.befs_i.i_index_cache;
+	if (map)
+		return map;
+
+	if (S_ISLNK(inode->i_mode))
+		return NULL;
+
+	BEFS_OUTPUT (("---> befs_get_extent_map() inode %lu\n",
+		inode->i_ino));
+
+	map = kmalloc (BEFS_EXTENT_MAP_SIZE(size), GFP_KERNEL);
+	if (!map)
+		return NULL;
+	BEFS_STAT_ALLOC(inode->i_sb, BEFS_ST_FILE_READ);
+	map->count = 0;
+	map->double_layout = BEFS_DOUBLE_UNKNOWN;
+
+	/*
+	 * Block runs of double-indirect block are computed directly,
+	 * so they are not read into extent map.
+	 */
+
+	while (1) {
+		iaddr = befs_next_run (inode, &i, BEFS_DS_INDIRECT);
+		if (BEFS_IS_EMPTY_IADDR(&iaddr))
+			break;
+
+		if (map->count == size) {
+
+			/*
+			 * extent map is full.  expand it.
+			 */
+
+			new = kmalloc (BEFS_EXTENT_MAP_SIZE(size * 2),
+				GFP_KERNEL);
+			if (!new) {
+				BEFS_OUTPUT (("<--- befs_get_extent_map() "
+					"cannot allocate memory\n"));
+				kfree (map);
+				return NULL;
+			}
+			BEFS_STAT_ALLOC(inode->i_sb, BEFS_ST_FILE_READ);
+			memcpy (new, map, BEFS_EXTENT_MAP_SIZE(size));
+			kfree (map);
+			map = new;
+			size *= 2;
+		}
+
+		map->extent[map->count].logical = logical;
+		map->extent[map->count].run = iaddr;
+		map->count++;
+
+		logical += iaddr.len;
+	}
+	map->blocks = logical;
+
+	/*
+	 * Other process may make extent map while we sleep.
+	 */
+
+	spin_lock (&befs_extent_lock);
+	if (inode->u.befs_i.i_index_cache) {
+		spin_unlock (&befs_extent_lock);
+		kfree (map);
+		return (befs_extent_map *) inode->u.befs_i.i_index_cache;
+	}
+	inode->u.befs_i.i_index_cache = map;
+	spin_unlock (&befs_extent_lock);
+
+	BEFS_OUTPUT (("<--- befs_get_extent_map() %d extents, %Ld blocks\n",
+		map->count, map->blocks));
+
+	return map;
+}
+
+
+void befs_put_extent_map (struct inode * inode)
+{
+	befs_extent_map * map;
+
+	spin_lock (&befs_extent_lock);
+	map = (befs_extent_map *) inode->u.befs_i.i_index_cache;
+	inode->u.befs_i.i_index_cache = NULL;
+	spin_unlock (&befs_extent_lock);
+
+	if (map)
+		kfree (map);
+}
+
+
+/*
+ * befs_walk_double_runs
+ *
+ * description:
+ *  Walk data block runs of double-indirect block in order, reading each
+ *  block once.  If iaddr is NULL, check that every indirect and data block
+ *  run is BEFS_DBLINDIR_BRUN_LEN blocks.  Or else find the block run which
+ *  has block.
+ *
+ * parameter:
+ *  inode ... inode of file
+ *  block ... block number from start of double-indirect block runs
+ *  iaddr ... found inode address, or NULL to check layout
+ *
+ * return value:
+ *  0      ... fixed-size layout, or block is found
+ *  1      ... not fixed-size layout
+ *  -EBADF ... cannot read block, or block is not found
+ */
+
+static int befs_walk_double_runs (struct inode * inode, befs_off_t block,
+	befs_inode_addr * iaddr)
+{
+	struct super_block * sb = inode->i_sb;
+	struct buffer_head * bh_double;
+	struct buffer_head * bh_indirect = NULL;
+	befs_inode_addr       addr = BEFS_I_DOUBLE_INDIRECT(inode);
+	befs_inode_addr       indirect;
+	befs_inode_addr       run;
+	befs_off_t            sum = 0;
+	int                  per_block = BEFS_BLOCK_PER_INODE(sb);
+	int                  i;
+	int                  j;
+	int                  err = iaddr ? -EBADF : 0;
+
+	for (; addr.len; addr.start++, addr.len--) {
+		BEFS_STAT_BREAD(sb, BEFS_ST_MAP_DOUBLE, 1);
+		bh_double = befs_bread2 (sb, addr);
+		if (!bh_double)
+			return -EBADF;
+
+		for (i = 0; i < per_block; i++) {
+#ifdef CONFIG_BEFS_CONV
+			befs_convert_inodeaddr (BEFS_TYPE(sb),
+				&((befs_inode_addr *) bh_double->b_data)[i],
+				&indirect);
+#else
+			indirect = ((befs_inode_addr *) bh_double->b_data)[i];
+#endif
+			if (BEFS_IS_EMPTY_IADDR(&indirect))
+				goto out;
+			if (!iaddr && indirect.len != BEFS_DBLINDIR_BRUN_LEN) {
+				err = 1;
+				goto out;
+			}
+
+			for (; indirect.len; indirect.start++, indirect.len--) {
+				BEFS_STAT_BREAD(sb, BEFS_ST_MAP_DOUBLE, 1);
+				bh_indirect = befs_bread2 (sb, indirect);
+				if (!bh_indirect) {
+					err = -EBADF;
+					goto out;
+				}
+
+				for (j = 0; j < per_block; j++) {
+#ifdef CONFIG_BEFS_CONV
+					befs_convert_inodeaddr (BEFS_TYPE(sb),
+						&((befs_inode_addr *)
+						bh_indirect->b_data)[j], &run);
+#else
+					run = ((befs_inode_addr *)
+						bh_indirect->b_data)[j];
+#endif
+					if (BEFS_IS_EMPTY_IADDR(&run))
+						goto out;
+
+					if (!iaddr) {
+						if (run.len
+							!= BEFS_DBLINDIR_BRUN_LEN) {
+							err = 1;
+							goto out;
+						}
+						continue;
+					}
+
+					if (block < sum + run.len) {
+						run.start += block - sum;
+						run.len -= block - sum;
+						*iaddr = run;
+						err = 0;
+						goto out;
+					}
+					sum += run.len;
+				}
+
+				brelse (bh_indirect);
+				bh_indirect = NULL;
+			}
+		}
+
+		brelse (bh_double);
+	}
+
+	return err;
+
+out:
+	if (bh_indirect)
+		brelse (bh_indirect);
+	brelse (bh_double);
+
+	return err;
+}
+
+
+/*
+ * befs_startpos_from_double_indirect
+ *
+ * description:
+ *  Get inode address of block in double-indirect block runs.  Layout of
+ *  double-indirect block is checked once and kept in extent map.  If it
+ *  is fixed-size, position of block run is computed directly.  Or else
+ *  block runs are walked in order.
+ *
+ * parameter:
+ *  inode ... inode of file
+ *  map   ... extent map of inode
+ *  block ... block number from start of double-indirect block runs
+ */
+
+static befs_inode_addr befs_startpos_from_double_indirect (
+	struct inode * inode, befs_extent_map * map, befs_off_t block)
+{
+	struct super_block * sb = inode->i_sb;
+	befs_inode_addr       double_indirect = BEFS_I_DOUBLE_INDIRECT(inode);
+	befs_inode_addr       iaddr = {0, 0, 0};
+	unsigned long        b = (unsigned long) block;
+	cycles_t             start = BEFS_STAT_START();
+	int                  err;
+
+	if (BEFS_IS_EMPTY_IADDR(&double_indirect))
+		return iaddr;
+
+	if (map->double_layout == BEFS_DOUBLE_UNKNOWN) {
+		err = befs_walk_double_runs (inode, 0, NULL);
+		if (err < 0)
+			return iaddr;
+
+		map->double_layout = err ? BEFS_DOUBLE_WALK : BEFS_DOUBLE_FIXED;
+	}
+
+	if (map->double_layout == BEFS_DOUBLE_FIXED) {
+		err = befs_read_double_indirect_block (sb, double_indirect,
+			b / BEFS_DBLINDIR_BRUN_LEN, &iaddr);
+		if (!err) {
+			iaddr.start += b % BEFS_DBLINDIR_BRUN_LEN;
+			iaddr.len -= b % BEFS_DBLINDIR_BRUN_LEN;
+		}
+	} else
+		err = befs_walk_double_runs (inode, block, &iaddr);
+
+	if (err) {
+		iaddr.allocation_group = 0;
+		iaddr.start = 0;
+		iaddr.len = 0;
+		return iaddr;
+	}
+
+	befs_stat_end (sb, BEFS_ST_MAP_DOUBLE, start);
+	BEFS_TRACE(BEFS_ST_MAP_DOUBLE, inode->i_ino, &iaddr, start);
+
+	return iaddr;
+}
+
+
 /*
  * Get inode address of start position form data stream
  */
 
-static befs_inode_addr befs_startpos_from_ds (struct super_block * sb,
-					befs_data_stream * ds, off_t pos)
+static befs_inode_addr befs_startpos_from_ds (struct inode * inode, loff_t pos)
 {
-	befs_inode_addr iaddr;
-	off_t          sum = 0;
-	int            i = 0;
+	struct super_block * sb = inode->i_sb;
+	befs_extent_map *     map;
+	befs_inode_addr       iaddr = {0, 0, 0};
+	befs_off_t            block = pos >> sb->u.befs_sb.block_shift;
+	befs_off_t            sum = 0;
+	int                  i = 0;
 
 	BEFS_OUTPUT (("---> befs_startpos_from_ds()\n"));
 
+	map = befs_get_extent_map (inode);
+	if (map) {
+		i = befs_find_extent (map, block);
+		if (i >= 0) {
+			iaddr = map->extent[i].run;
+			iaddr.start += block - map->extent[i].logical;
+			iaddr.len -= block - map->extent[i].logical;
+		} else if (block >= map->blocks) {
+			iaddr = befs_startpos_from_double_indirect (inode,
+				map, block - map->blocks);
+		}
+
+		BEFS_OUTPUT (("<--- befs_startpos_from_ds() extent %d\n", i));
+
+		return iaddr;
+	}
+
 	/*
-	 * Get start position
+	 * Cannot allocate extent map, so explore data stream.
 	 */
 
 	while(1) {
-		iaddr = befs_read_data_stream (sb, ds, &i);
+		iaddr = befs_read_data_stream (inode, &i);
 		if (BEFS_IS_EMPTY_IADDR(&iaddr)) {
 			BEFS_OUTPUT ((" end data_stream\n"));
 			break;
 		}
 
-		if ((pos >= sum)
-			&& (pos < sum + iaddr.len * sb->u.befs_sb.block_size)) {
-
-			iaddr.start += (pos - sum) / sb->u.befs_sb.block_size;
-			iaddr.len -= (pos - sum) / sb->u.befs_sb.block_size;
+		if (block < sum + iaddr.len) {
+			iaddr.start += block - sum;
+			iaddr.len -= block - sum;
 			break;
 		}
 
-		sum += iaddr.len * sb->u.befs_sb.block_size;
+		sum += iaddr.len;
 	}
 
 	BEFS_OUTPUT (("<--- befs_startpos_from_ds()\n"));
 
 	return iaddr;
 }
+
+
+/*
+ * befs_bread_stream
+ *
+ * description:
+ *  get buffer_head of block which has offset of data stream.
+ *
+ * parameter:
+ *  inode  ... inode
+ *  offset ... offset into data stream
+ */
+
+struct buffer_head * befs_bread_stream (struct inode * inode,
+	befs_off_t offset)
+{
+	befs_inode_addr iaddr;
+
+	iaddr = befs_startpos_from_ds (inode, offset);
+	if (BEFS_IS_EMPTY_IADDR(&iaddr)) {
+		BEFS_OUTPUT (("befs_bread_stream() out of data stream %Ld\n",
+			offset));
+		return NULL;
+	}
+
+	return befs_bread2 (inode->i_sb, iaddr);
+}
+
+
+/*
+ * befs_prefetch_stream
+ *
+ * description:
+ *  start reading block which has offset of data stream, but don't wait.
+ */
+
+void befs_prefetch_stream (struct inode * inode, befs_off_t offset)
+{
+	struct buffer_head * bh;
+	befs_inode_addr       iaddr;
+
+	iaddr = befs_startpos_from_ds (inode, offset);
+	if (BEFS_IS_EMPTY_IADDR(&iaddr))
+		return;
+
+	bh = getblk (inode->i_dev,
+		BEFS_IADDR2INO(&iaddr, &inode->i_sb->u.befs_sb),
+		inode->i_sb->s_blocksize);
+	if (!buffer_uptodate (bh))
+		ll_rw_block (READA, 1, &bh);
+	brelse (bh);
+}
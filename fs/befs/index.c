@@ -14,7 +14,31 @@
 #include <linux/befs_fs.h>
 #include <linux/sched.h>
 #include <linux/stat.h>
+#include <linux/string.h>
 #include <linux/mm.h>
+#include <linux/malloc.h>
+#include <linux/spinlock.h>
+
+#include <asm/unaligned.h>
+
+
+/*
+ * Cache of decoded index nodes
+ *
+ *  BEFS_NODE_CACHE_SIZE  ... max number of nodes per directory
+ *  BEFS_NODE_CACHE_LIMIT ... max bytes of all caches
+ *
+ *  All cached nodes are also linked in one LRU list of all directories,
+ *  and the least recently used nodes are dropped over the limit.
+ */
+
+#define BEFS_NODE_CACHE_SIZE  16
+#define BEFS_NODE_CACHE_LIMIT (512 * 1024)
+
+static spinlock_t befs_node_lock = SPIN_LOCK_UNLOCKED;
+static befs_node * befs_node_lru_head = NULL;	/* most recently used */
+static befs_node * befs_node_lru_tail = NULL;	/* least recently used */
+int               befs_node_cache_bytes = 0;
 
 
 static void befs_convert_index_entry (int, befs_index_entry *,
@@ -27,58 +51,14 @@ static void befs_convert_index_entry (int, befs_index_entry *,
 static void befs_convert_index_entry (int fstype, befs_index_entry * entry,
 	befs_index_entry * out)
 {
-	switch (fstype)
-	{
-	case BEFS_X86:
-		out->magic = le32_to_cpu(entry->magic);
-		out->node_size = le32_to_cpu(entry->node_size);
-		out->max_number_of_levels =
-			le32_to_cpu(entry->max_number_of_levels);
-		out->data_type = le32_to_cpu(entry->data_type);
-		out->root_node_pointer =
-			le64_to_cpu(entry->root_node_pointer);
-		out->free_node_pointer =
-			le64_to_cpu(entry->free_node_pointer);
-		out->maximum_size = le64_to_cpu(entry->maximum_size);
-		break;
-
-	case BEFS_PPC:
-		out->magic = be32_to_cpu(entry->magic);
-		out->node_size = be32_to_cpu(entry->node_size);
-		out->max_number_of_levels =
-			be32_to_cpu(entry->max_number_of_levels);
-		out->data_type = be32_to_cpu(entry->data_type);
-		out->root_node_pointer =
-			be64_to_cpu(entry->root_node_pointer);
-		out->free_node_pointer =
-			be64_to_cpu(entry->free_node_pointer);
-		out->maximum_size = be64_to_cpu(entry->maximum_size);
-		break;
-	}
-}
-
-
-void befs_convert_index_node (int fstype, befs_index_node * node,
-	befs_index_node * out)
-{
-	switch (fstype)
-	{
-	case BEFS_X86:
-		out->left = le64_to_cpu (node->left);
-		out->right = le64_to_cpu (node->right);
-		out->overflow = le64_to_cpu (node->overflow);
-		out->all_key_count = le16_to_cpu (node->all_key_count);
-		out->all_key_length = le16_to_cpu (node->all_key_length);
-		break;
-
-	case BEFS_PPC:
-		out->left = be64_to_cpu (node->left);
-		out->right = be64_to_cpu (node->right);
-		out->overflow = be64_to_cpu (node->overflow);
-		out->all_key_count = be16_to_cpu (node->all_key_count);
-		out->all_key_length = be16_to_cpu (node->all_key_length);
-		break;
-	}
+	out->magic = befs32_to_cpu(fstype, entry->magic);
+	out->node_size = befs32_to_cpu(fstype, entry->node_size);
+	out->max_number_of_levels =
+		befs32_to_cpu(fstype, entry->max_number_of_levels);
+	out->data_type = befs32_to_cpu(fstype, entry->data_type);
+	out->root_node_pointer = befs64_to_cpu(fstype, entry->root_node_pointer);
+	out->free_node_pointer = befs64_to_cpu(fstype, entry->free_node_pointer);
+	out->maximum_size = befs64_to_cpu(fstype, entry->maximum_size);
 }
 
 
@@ -102,6 +82,8 @@ struct buffer_head * befs_read_index_node (befs_inode_addr inode,
 	struct buffer_head * bh;
 	befs_inode_addr       iaddr;
 	befs_index_entry *    entry;
+	__u32                node_size;
+	cycles_t             start = BEFS_STAT_START();
 
 	BEFS_OUTPUT (("---> befs_read_index_node() "
 		"index [%lu, %u, %u]\n",
@@ -118,29 +100,16 @@ struct buffer_head * befs_read_index_node (befs_inode_addr inode,
 			printk (KERN_ERR "BEFS: cannot read index entry.\n");
 			return NULL;
 		}
-#ifdef CONFIG_BEFS_CONV
-		entry = (befs_index_entry *) __getname();;
-		if (!entry) {
-			printk (KERN_ERR "BEFS: cannot allocate memory\n");
-			return NULL;
-		}
-
-		/*
-		 * Convert little-edian and big-edian.
-		 */
-
-		befs_convert_index_entry (sb->u.befs_sb.mount_opts.befs_type,
-			(befs_index_entry *) bh->b_data, entry);
-#else
+		BEFS_STAT_BREAD(sb, BEFS_ST_INDEX_NODE, 1);
 		entry = (befs_index_entry *) bh->b_data;
-#endif
 		BEFS_DUMP_INDEX_ENTRY (entry);
 
 		/*
 		 * check magic header
 		 */
 
-		if (entry->magic != BEFS_INDEX_MAGIC) {
+		if (befs32_to_cpu(BEFS_TYPE(sb), entry->magic)
+			!= BEFS_INDEX_MAGIC) {
 
 			/*
 			 * bad magic header
@@ -148,9 +117,6 @@ struct buffer_head * befs_read_index_node (befs_inode_addr inode,
 
 			printk (KERN_ERR "BEFS: "
 				"magic header of index entry is bad value.\n");
-#ifdef CONFIG_BEFS_CONV
-			putname (entry);
-#endif
 			brelse(bh);
 
 			return NULL;
@@ -160,25 +126,23 @@ struct buffer_head * befs_read_index_node (befs_inode_addr inode,
 		 * set index entry postion
 		 */
 
+		node_size = befs32_to_cpu(BEFS_TYPE(sb), entry->node_size);
+
 		*offset = 0;
 		iaddr = inode;
-		if (entry->node_size < sb->u.befs_sb.block_size) {
+		if (node_size < sb->u.befs_sb.block_size) {
 
 			/*
 			 * exist index node into index entry's block
 			 */
 
-			*offset = entry->node_size;
+			*offset = node_size;
 		} else {
-			iaddr.start += entry->node_size
-				/ sb->u.befs_sb.block_size;
-			iaddr.len -= entry->node_size / sb->u.befs_sb.block_size;
-			*offset = entry->node_size % sb->u.befs_sb.block_size;
+			iaddr.start += node_size / sb->u.befs_sb.block_size;
+			iaddr.len -= node_size / sb->u.befs_sb.block_size;
+			*offset = node_size % sb->u.befs_sb.block_size;
 		}
 
-#ifdef CONFIG_BEFS_CONV
-		putname (entry);
-#endif
 		brelse(bh);
 
 	} else {
@@ -190,6 +154,10 @@ struct buffer_head * befs_read_index_node (befs_inode_addr inode,
 	BEFS_DUMP_INODE_ADDR (iaddr);
 
 	bh = befs_bread2 (sb, iaddr);
+	if (bh)
+		BEFS_STAT_BREAD(sb, BEFS_ST_INDEX_NODE, 1);
+	befs_stat_end (sb, BEFS_ST_INDEX_NODE, start);
+	BEFS_TRACE(BEFS_ST_INDEX_NODE, 0, &iaddr, start);
 
 	BEFS_OUTPUT (("<--- befs_read_index_node() %s offset = %016x\n",
 		(bh ? "success" : "fail"), *offset));
@@ -198,6 +166,578 @@ struct buffer_head * befs_read_index_node (befs_inode_addr inode,
 }
 
 
+/*
+ * befs_compare_key
+ *
+ * description:
+ *  compare two keys of B+tree like BeOS.  Keys are compared by bytes,
+ *  and if a key is prefix of another, shorter key is less.
+ *
+ * return value:
+ *  < 0 ... key1 is less than key2
+ *  0   ... key1 equals key2
+ *  > 0 ... key1 is greater than key2
+ */
+
+int befs_compare_key (const char * key1, int len1, const char * key2, int len2)
+{
+	int cmp;
+
+	cmp = memcmp (key1, key2, len1 < len2 ? len1 : len2);
+	if (cmp)
+		return cmp;
+
+	return len1 - len2;
+}
+
+
+/*
+ * befs_read_index_header
+ *
+ * description:
+ *  read index entry (header of B+tree) of directory, and convert it.
+ *  Number of levels is checked, so descent by it always ends.
+ *
+ * parameter:
+ *  dir   ... inode of directory
+ *  entry ... index entry return
+ *
+ * return value:
+ *  0 ... sucess
+ */
+
+int befs_read_index_header (struct inode * dir, befs_index_entry * entry)
+{
+	struct buffer_head * bh;
+
+	BEFS_OUTPUT (("---> befs_read_index_header() inode %lu\n",
+		dir->i_ino));
+
+	bh = befs_bread_stream (dir, 0);
+	if (!bh) {
+		printk (KERN_ERR "BEFS: cannot read index entry.\n");
+		return -EBADF;
+	}
+	BEFS_STAT_BREAD(dir->i_sb, BEFS_ST_INDEX_NODE, 1);
+
+#ifdef CONFIG_BEFS_CONV
+	befs_convert_index_entry (BEFS_TYPE(dir->i_sb),
+		(befs_index_entry *) bh->b_data, entry);
+#else
+	*entry = *(befs_index_entry *) bh->b_data;
+#endif
+	brelse (bh);
+
+	BEFS_DUMP_INDEX_ENTRY (entry);
+
+	/*
+	 * check magic header and node size.
+	 *  Node size must be power of 2, and index node must not cross block.
+	 */
+
+	if (entry->magic != BEFS_INDEX_MAGIC) {
+		printk (KERN_ERR "BEFS: "
+			"magic header of index entry is bad value.\n");
+		return -EBADF;
+	}
+
+	if (entry->node_size < sizeof(befs_index_node)
+		|| (entry->node_size & (entry->node_size - 1))
+		|| entry->node_size > dir->i_sb->u.befs_sb.block_size) {
+
+		printk (KERN_ERR "BEFS: "
+			"node size of index entry is bad value.\n");
+		return -EBADF;
+	}
+
+	if (entry->max_number_of_levels > BEFS_BT_MAX_LEVELS) {
+		printk (KERN_ERR "BEFS: too many levels of index - "
+			"inode = %lu\n", dir->i_ino);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+
+/*
+ * befs_read_node
+ *
+ * description:
+ *  read index node at offset of directory's data stream.
+ *
+ * parameter:
+ *  dir    ... inode of directory
+ *  offset ... offset of index node into data stream
+ *  node   ... index node return (raw disk format)
+ *
+ * return value:
+ *  buffer_head which has index node.  Caller must release it.
+ */
+
+struct buffer_head * befs_read_node (struct inode * dir, befs_off_t offset,
+	befs_index_node ** node)
+{
+	struct buffer_head * bh;
+
+	BEFS_OUTPUT (("---> befs_read_node() offset %Ld\n", offset));
+
+	bh = befs_bread_stream (dir, offset);
+	if (!bh)
+		return NULL;
+
+	*node = (befs_index_node *) (bh->b_data
+		+ (offset & (dir->i_sb->u.befs_sb.block_size - 1)));
+
+	return bh;
+}
+
+
+#ifdef CONFIG_BEFS_CONV
+/*
+ * befs_swab_keys
+ *
+ * description:
+ *  Swap byte order of key offsets and values of index node in one pass.
+ *  Two 16 bits offsets are swapped at once in a 32 bits word.
+ *
+ * parameter:
+ *  key_end   ... key offsets return
+ *  value     ... values return
+ *  key_array ... key offsets of index node (raw disk format)
+ *  key_value ... values of index node (raw disk format, maybe unaligned)
+ *  count     ... number of keys
+ */
+
+static void befs_swab_keys (__u16 * key_end, befs_off_t * value,
+	__u16 * key_array, befs_off_t * key_value, int count)
+{
+	__u32 w;
+	int   i;
+
+	for (i = 0; i + 1 < count; i += 2) {
+		w = get_unaligned ((__u32 *) &key_array[i]);
+		w = ((w & 0x00ff00ffUL) << 8) | ((w >> 8) & 0x00ff00ffUL);
+		put_unaligned (w, (__u32 *) &key_end[i]);
+	}
+	if (i < count)
+		key_end[i] = __swab16 (key_array[i]);
+
+	for (i = 0; i < count; i++)
+		value[i] = __swab64 (get_unaligned (&key_value[i]));
+}
+#endif
+
+
+/*
+ * befs_decode_node
+ *
+ * description:
+ *  Decode index node to befs_node.  Header, key offsets and values are
+ *  converted to cpu byte order.
+ *
+ * parameter:
+ *  sb     ... super block
+ *  bn     ... index node (raw disk format)
+ *  offset ... offset of index node into data stream
+ *  limit  ... max size of index node
+ *
+ * return value:
+ *  decoded node, or NULL if index node is broken or cannot allocate memory.
+ */
+
+static befs_node * befs_decode_node (struct super_block * sb,
+	befs_index_node * bn, befs_off_t offset, int limit)
+{
+	befs_node *  node;
+	char *      key;
+	__u16 *     key_array;
+	befs_off_t * key_value;
+	int         key_count;
+	int         key_length;
+	int         key_offset;
+	int         fstype = BEFS_TYPE(sb);
+	int         size;
+	int         i;
+
+	key_count = befs16_to_cpu (fstype, bn->all_key_count);
+	key_length = befs16_to_cpu (fstype, bn->all_key_length);
+
+	key = (char *) bn + sizeof(befs_index_node);
+	key_offset = (key_length + sizeof(befs_index_node)) % 8;
+	key_array = (__u16 *) (key + key_length
+		+ (!key_offset ? 0 : 8 - key_offset));
+	key_value = (befs_off_t *) (((char *) key_array) + sizeof(__u16)
+		* key_count);
+
+	if ((char *) (key_value + key_count) - (char *) bn > limit) {
+		printk (KERN_ERR "BEFS: index node is broken - "
+			"offset = %Ld\n", offset);
+		return NULL;
+	}
+
+	size = sizeof(befs_node)
+		+ key_count * (sizeof(befs_off_t) + sizeof(__u16)) + key_length;
+	node = (befs_node *) kmalloc (size, GFP_KERNEL);
+	if (!node)
+		return NULL;
+
+	node->next = NULL;
+	node->count = 1;
+	node->size = size;
+	node->offset = offset;
+	node->left = befs64_to_cpu (fstype, bn->left);
+	node->right = befs64_to_cpu (fstype, bn->right);
+	node->overflow = befs64_to_cpu (fstype, bn->overflow);
+	node->all_key_count = key_count;
+	node->all_key_length = key_length;
+	node->value = (befs_off_t *) (node + 1);
+	node->key_end = (__u16 *) (node->value + key_count);
+	node->key = (char *) (node->key_end + key_count);
+
+#ifdef CONFIG_BEFS_CONV
+	if (fstype != BEFS_NATIVE_TYPE) {
+		befs_swab_keys (node->key_end, node->value, key_array,
+			key_value, key_count);
+	} else
+#endif
+	{
+		memcpy (node->key_end, key_array, key_count * sizeof(__u16));
+		memcpy (node->value, key_value,
+			key_count * sizeof(befs_off_t));
+	}
+	memcpy (node->key, key, key_length);
+
+	/*
+	 * check key offsets
+	 */
+
+	for (i = 0; i < key_count; i++) {
+		if (node->key_end[i] > key_length
+			|| (i && node->key_end[i] < node->key_end[i - 1])) {
+
+			printk (KERN_ERR "BEFS: key of index node is broken - "
+				"offset = %Ld\n", offset);
+			kfree (node);
+			return NULL;
+		}
+	}
+
+	return node;
+}
+
+
+/*
+ * LRU list of cached nodes.  Called with befs_node_lock held.
+ */
+
+static void befs_node_lru_del (befs_node * node)
+{
+	if (node->lru_prev)
+		node->lru_prev->lru_next = node->lru_next;
+	else
+		befs_node_lru_head = node->lru_next;
+
+	if (node->lru_next)
+		node->lru_next->lru_prev = node->lru_prev;
+	else
+		befs_node_lru_tail = node->lru_prev;
+}
+
+
+static void befs_node_lru_add (befs_node * node)
+{
+	node->lru_prev = NULL;
+	node->lru_next = befs_node_lru_head;
+
+	if (befs_node_lru_head)
+		befs_node_lru_head->lru_prev = node;
+	else
+		befs_node_lru_tail = node;
+	befs_node_lru_head = node;
+}
+
+
+/*
+ * befs_drop_node
+ *
+ *  remove node from cache of its directory and LRU list.  Called with
+ *  befs_node_lock held.
+ */
+
+static void befs_drop_node (befs_node * node)
+{
+	befs_node ** p;
+
+	for (p = &node->dir->u.befs_i.i_node_cache; *p; p = &(*p)->next) {
+		if (*p == node) {
+			*p = node->next;
+			break;
+		}
+	}
+	befs_node_lru_del (node);
+
+	befs_node_cache_bytes -= node->size;
+	if (!--node->count)
+		kfree (node);
+}
+
+
+/*
+ * befs_get_node
+ *
+ * description:
+ *  Get decoded index node at offset of directory's data stream.  Recently
+ *  used nodes are cached in i_node_cache of directory.  The cache has
+ *  BEFS_NODE_CACHE_SIZE nodes at most per directory.  When all caches use
+ *  more than BEFS_NODE_CACHE_LIMIT bytes, the least recently used nodes
+ *  of any directory are dropped.  The rest is released when the directory
+ *  inode is released from inode cache.
+ *
+ * parameter:
+ *  dir    ... inode of directory
+ *  offset ... offset of index node into data stream
+ *
+ * return value:
+ *  decoded node.  Caller must release it by befs_put_node.
+ */
+
+befs_node * befs_get_node (struct inode * dir, befs_off_t offset)
+{
+	struct super_block * sb = dir->i_sb;
+	struct buffer_head * bh;
+	befs_index_node *     bn;
+	befs_node *           node;
+	befs_node *           new;
+	befs_node **          p;
+	cycles_t             start;
+	int                  n;
+
+	spin_lock (&befs_node_lock);
+	for (p = &dir->u.befs_i.i_node_cache; (node = *p); p = &node->next) {
+		if (node->offset == offset) {
+
+			/*
+			 * cache hit.  move it to head.
+			 */
+
+			*p = node->next;
+			node->next = dir->u.befs_i.i_node_cache;
+			dir->u.befs_i.i_node_cache = node;
+			befs_node_lru_del (node);
+			befs_node_lru_add (node);
+			node->count++;
+			spin_unlock (&befs_node_lock);
+
+			return node;
+		}
+	}
+	spin_unlock (&befs_node_lock);
+
+	BEFS_OUTPUT (("befs_get_node() read offset %Ld\n", offset));
+
+	start = BEFS_STAT_START();
+
+	bh = befs_read_node (dir, offset, &bn);
+	if (!bh)
+		return NULL;
+	BEFS_STAT_BREAD(sb, BEFS_ST_INDEX_NODE, 1);
+
+	new = befs_decode_node (sb, bn, offset, sb->u.befs_sb.block_size
+		- (offset & (sb->u.befs_sb.block_size - 1)));
+	brelse (bh);
+	if (!new)
+		return NULL;
+	BEFS_STAT_ALLOC(sb, BEFS_ST_INDEX_NODE);
+	befs_stat_end (sb, BEFS_ST_INDEX_NODE, start);
+	BEFS_TRACE(BEFS_ST_INDEX_NODE, dir->i_ino, NULL, start);
+
+	spin_lock (&befs_node_lock);
+
+	/*
+	 * Other process may read same node while we sleep.
+	 */
+
+	for (node = dir->u.befs_i.i_node_cache; node; node = node->next) {
+		if (node->offset == offset) {
+			node->count++;
+			spin_unlock (&befs_node_lock);
+			kfree (new);
+
+			return node;
+		}
+	}
+
+	/*
+	 * Add to head of cache and LRU list.  Drop the tail of cache of
+	 * this directory if it has too many nodes, and the tail of LRU list
+	 * while all caches are over limit.
+	 */
+
+	new->count++;
+	new->dir = dir;
+	new->next = dir->u.befs_i.i_node_cache;
+	dir->u.befs_i.i_node_cache = new;
+	befs_node_lru_add (new);
+	befs_node_cache_bytes += new->size;
+
+	for (n = 0, node = new; node->next; node = node->next)
+		n++;
+	if (n >= BEFS_NODE_CACHE_SIZE)
+		befs_drop_node (node);
+
+	while (befs_node_cache_bytes > BEFS_NODE_CACHE_LIMIT
+		&& befs_node_lru_tail != new)
+		befs_drop_node (befs_node_lru_tail);
+	spin_unlock (&befs_node_lock);
+
+	return new;
+}
+
+
+void befs_put_node (befs_node * node)
+{
+	spin_lock (&befs_node_lock);
+	if (!--node->count)
+		kfree (node);
+	spin_unlock (&befs_node_lock);
+}
+
+
+/*
+ * befs_put_node_cache
+ *
+ *  release all cached nodes of directory.
+ */
+
+void befs_put_node_cache (struct inode * dir)
+{
+	befs_node * node;
+
+	spin_lock (&befs_node_lock);
+	while ((node = dir->u.befs_i.i_node_cache))
+		befs_drop_node (node);
+	spin_unlock (&befs_node_lock);
+}
+
+
+/*
+ * befs_search_node
+ *
+ * description:
+ *  Binary search of key in decoded index node.  Keys are compared in
+ *  place, so they are not copied.
+ *
+ * parameter:
+ *  node   ... decoded index node
+ *  name   ... key to search
+ *  len    ... length of key
+ *  pos    ... position of first key which is not less than name return
+ *  value  ... value of key at *pos return (if *pos < number of keys)
+ *
+ * return value:
+ *  0       ... found name
+ *  -ENOENT ... not found
+ */
+
+int befs_search_node (befs_node * node, const char * name, int len,
+	int * pos, befs_off_t * value)
+{
+	int lo = 0;
+	int hi = node->all_key_count - 1;
+	int mid;
+	int cmp;
+	char * key;
+	int key_len;
+	int err = -ENOENT;
+
+	while (lo <= hi) {
+		mid = (lo + hi) >> 1;
+
+		key = BEFS_NODE_KEY(node, mid, key_len);
+		cmp = befs_compare_key (key, key_len, name, len);
+		if (cmp < 0) {
+			lo = mid + 1;
+		} else if (cmp > 0) {
+			hi = mid - 1;
+		} else {
+			lo = mid;
+			err = 0;
+			break;
+		}
+	}
+
+	*pos = lo;
+	if (lo < node->all_key_count)
+		*value = node->value[lo];
+
+	BEFS_OUTPUT (("befs_search_node() pos %d/%d %s\n", lo,
+		node->all_key_count, err ? "not found" : "found"));
+
+	return err;
+}
+
+
+/*
+ * befs_first_leaf
+ *
+ * description:
+ *  Descend B+tree of directory to the leftmost leaf node.
+ *
+ * parameter:
+ *  dir   ... inode of directory
+ *  entry ... index entry of directory
+ *  leaf  ... offset of the leftmost leaf node return
+ *
+ * return value:
+ *  0 ... sucess
+ */
+
+int befs_first_leaf (struct inode * dir, befs_index_entry * entry,
+	befs_off_t * leaf)
+{
+	befs_node *  node;
+	befs_off_t   node_off = entry->root_node_pointer;
+	int         level;
+
+	/*
+	 * entry is given by caller.  Do not trust its depth.
+	 */
+
+	if (entry->max_number_of_levels > BEFS_BT_MAX_LEVELS)
+		return -EBADF;
+
+	for (level = 0; level <= entry->max_number_of_levels; level++) {
+		node = befs_get_node (dir, node_off);
+		if (!node)
+			return -EBADF;
+
+		if (node->overflow == BEFS_BT_NULL) {
+			befs_put_node (node);
+			*leaf = node_off;
+
+			BEFS_OUTPUT (("befs_first_leaf() %Ld\n", node_off));
+
+			return 0;
+		}
+
+		/*
+		 * The leftmost child is value of the first key.  If no key
+		 * exists, it is overflow link.
+		 */
+
+		if (node->all_key_count)
+			node_off = node->value[0];
+		else
+			node_off = node->overflow;
+
+		befs_put_node (node);
+	}
+
+	return -EBADF;
+}
+
+
 /*
  * befs_get_key_from_index_node
  *
@@ -220,8 +760,10 @@ char * befs_get_key_from_index_node (befs_index_node * node, int *pos, int fstyp
 	__u16 *          key_array;
 	befs_off_t *      key_value;
 	int              key_offset;
-	char *           namep = NULL;
-	befs_index_node * bn;
+	int              key_count;
+	int              key_length;
+	int              key_start;
+	char *           namep;
 
 	BEFS_OUTPUT (("---> befs_get_key_from_index_node() "
 		"pos %d\n", *pos));
@@ -230,21 +772,11 @@ char * befs_get_key_from_index_node (befs_index_node * node, int *pos, int fstyp
 	 * Convert little endian and big endian.
 	 */
 
-#ifdef CONFIG_BEFS_CONV
-	bn = (befs_index_node *) __getname();
-	if (!bn)
-		return NULL;
-
-	befs_convert_index_node (fstype, node, bn);
-#else
-	bn = node;
-#endif
+	key_count = befs16_to_cpu(fstype, node->all_key_count);
+	key_length = befs16_to_cpu(fstype, node->all_key_length);
 
-	if (*pos < 0 || bn->all_key_count <= *pos) {
+	if (*pos < 0 || key_count <= *pos) {
 		*pos = -1;
-#ifdef CONFIG_BEFS_CONV
-		putname(bn);
-#endif
 		return NULL;
 	}
 
@@ -253,18 +785,18 @@ char * befs_get_key_from_index_node (befs_index_node * node, int *pos, int fstyp
 	 */
 
 	key = (char*) node + sizeof(befs_index_node);
-	key_offset = (bn->all_key_length + sizeof(befs_index_node)) % 8;
-	key_array = (__u16 *) (key + bn->all_key_length
+	key_offset = (key_length + sizeof(befs_index_node)) % 8;
+	key_array = (__u16 *) (key + key_length
 		+ (!key_offset ? 0 : 8 - key_offset));
 	key_value = (befs_off_t *) (((char *) key_array) + sizeof(__u16)
-		* bn->all_key_count);
+		* key_count);
 #ifdef BEFS_DEBUG
 	{
 		int j;
 		char key_test[4096];
 
-		memcpy (key_test, key, bn->all_key_length);
-		key_test[bn->all_key_length] = '\0';
+		memcpy (key_test, key, key_length);
+		key_test[key_length] = '\0';
 
 		BEFS_OUTPUT ((" key content %s\n", key_test));
 
@@ -275,50 +807,10 @@ char * befs_get_key_from_index_node (befs_index_node * node, int *pos, int fstyp
 		}
 	}
 #endif
-#ifdef CONFIG_BEFS_CONV
-	switch (fstype)
-	{
-	case BEFS_X86:
-		if (*pos == 0) {
-			namep = key;
-			*len = le16_to_cpu(key_array[*pos]);
-		} else {
-			namep = key + le16_to_cpu(key_array[*pos - 1]);
-			*len = le16_to_cpu(key_array[*pos])
-				- le16_to_cpu(key_array[*pos - 1]);
-		}
-		*iaddr = le64_to_cpu(key_value[*pos]);
-		break;
-
-	case BEFS_PPC:
-		if (*pos == 0) {
-			namep = key;
-			*len = be16_to_cpu(key_array[*pos]);
-		} else {
-			namep = key + be16_to_cpu(key_array[*pos - 1]);
-			*len = be16_to_cpu(key_array[*pos])
-				- be16_to_cpu(key_array[*pos - 1]);
-		}
-		*iaddr = be64_to_cpu(key_value[*pos]);
-		break;
-	default:
-		/*
-		 * Unknown filesystem type
-		 */
-		putname(bn);
-		return NULL;
-	}
-#else
-	if (!*pos) {
-		namep = key;
-		*len = key_array[*pos];
-	} else {
-		namep = key + key_array[*pos - 1];
-		*len = key_array[*pos] - key_array[*pos - 1];
-	}
-
-	*iaddr = key_value[*pos];
-#endif
+	key_start = *pos ? befs16_to_cpu(fstype, key_array[*pos - 1]) : 0;
+	namep = key + key_start;
+	*len = befs16_to_cpu(fstype, key_array[*pos]) - key_start;
+	*iaddr = befs64_to_cpu(fstype, get_unaligned (&key_value[*pos]));
 
 	/*
 	 * copy from namep to name
@@ -328,10 +820,6 @@ char * befs_get_key_from_index_node (befs_index_node * node, int *pos, int fstyp
 	name[*len] = '\0';
 	(*pos)++;
 
-#ifdef CONFIG_BEFS_CONV
-	putname (bn);
-#endif
-
 	BEFS_OUTPUT (("<--- befs_get_key_from_index_node() "
 		"result key [%s], value %u\n", name, *iaddr));
 
@@ -350,9 +838,9 @@ int befs_is_key_into_index (struct super_block * sb,
 	befs_inode_addr index_iaddr, int flags, char * keyname, int * rpos)
 {
 	int                   pos;
-	char *                tmpname = NULL;
+	char                  tmpname[BEFS_NAME_LEN + 1];
 	int                   len;
-	befs_index_node *      node = NULL;
+	int                   key_count;
 	struct buffer_head *  bh = NULL;
 	befs_index_node *      bn = NULL;
 	befs_off_t             offset;
@@ -370,31 +858,10 @@ int befs_is_key_into_index (struct super_block * sb,
 		return -EBADF;
 
 	bn = (befs_index_node *) (bh->b_data + offset);
-
-#ifdef CONFIG_BEFS_CONV
-	node = (befs_index_node *) __getname();
-	if (!node) {
-		brelse (bh);
-
-		return -ENOMEM;
-	}
-
-	befs_convert_index_node (BEFS_TYPE(sb), bn, node);
-#else
-	node = bn;
-#endif
-
-	tmpname = (char *) __getname();
-	if (!tmpname) {
-		brelse (bh);
-#ifdef CONFIG_BEFS_CONV
-		putname (node);
-#endif
-		return -ENOMEM;
-	}
+	key_count = befs16_to_cpu(BEFS_TYPE(sb), bn->all_key_count);
 
 	pos = 0;
-	for (pos = 0; pos < node->all_key_count; ) {
+	for (pos = 0; pos < key_count; ) {
 		if (!befs_get_key_from_index_node (bn, &pos, BEFS_TYPE(sb),
 			tmpname, &len, &value)) {
 
@@ -404,10 +871,6 @@ int befs_is_key_into_index (struct super_block * sb,
 				 */
 
 				brelse (bh);
-				putname (tmpname);
-#ifdef CONFIG_BEFS_CONV
-				putname (node);
-#endif
 
 				return -EBADF;
 			} else {
@@ -430,10 +893,6 @@ int befs_is_key_into_index (struct super_block * sb,
 			*rpos = pos;
 
 			brelse (bh);
-			putname (tmpname);
-#ifdef CONFIG_BEFS_CONV
-			putname (node);
-#endif
 
 			return 0;
 		}
@@ -446,10 +905,6 @@ int befs_is_key_into_index (struct super_block * sb,
 	*rpos = -1;
 
 	brelse (bh);
-	putname (tmpname);
-#ifdef CONFIG_BEFS_CONV
-	putname (node);
-#endif
 
 	return 0;
 }	
@@ -494,18 +949,5 @@ int befs_delete_index_node (struct super_block * sb, befs_inode_addr iaddr,
 		return -EBADF;
 
 	bn = (befs_index_node *) (bh->b_data + offset);
-
-#ifdef CONFIG_BEFS_CONV
-	node = (befs_index_node *) __getname();
-	if (!node) {
-		brelse (bh);
-
-		return -ENOMEM;
-	}
-
-	befs_convert_index_node (BEFS_TYPE(sb), bn, node);
-#else
-	node = bn;
-#endif
 }
 #endif
@@ -23,6 +23,7 @@
 #include <linux/string.h>
 #include <linux/locks.h>
 #include <linux/mm.h>
+#include <linux/malloc.h>
 
 
 static int befs_update_inode(struct inode *, int);
@@ -33,15 +34,17 @@ static int befs_update_inode(struct inode *, int);
 
 int befs_bmap (struct inode * inode, int block)
 {
-	struct befs_sb_info    bs = inode->i_sb->u.befs_sb;
-	struct befs_inode_info bi = inode->u.befs_i;
+	struct buffer_head tmp;
 
 	BEFS_OUTPUT (("---> Enter befs_bmap\n"));
 
+	tmp.b_state = 0;
+	tmp.b_blocknr = 0;
+	befs_get_block (inode, block, &tmp, 0);
+
 	BEFS_OUTPUT (("<--- Enter befs_bmap\n"));
 
-	return  (bi.i_inode_num.allocation_group << bs.ag_shift)
-		+ bi.i_inode_num.start;
+	return buffer_mapped(&tmp) ? tmp.b_blocknr : 0;
 }
 
 
@@ -97,132 +100,70 @@ struct buffer_head * befs_bread2 (struct super_block * sb, befs_inode_addr inode
 void befs_convert_inodeaddr (int fstype, befs_inode_addr * iaddr,
 	befs_inode_addr * out)
 {
-	switch (fstype)
-	{
-	case BEFS_X86:
-		out->allocation_group = le32_to_cpu(iaddr->allocation_group);
-		out->start = le16_to_cpu(iaddr->start);
-		out->len = le16_to_cpu(iaddr->len);
-		break;
-
-	case BEFS_PPC:
-		out->allocation_group = be32_to_cpu(iaddr->allocation_group);
-		out->start = be16_to_cpu(iaddr->start);
-		out->len = be16_to_cpu(iaddr->len);
-		break;
-	}
+	out->allocation_group = befs32_to_cpu(fstype, iaddr->allocation_group);
+	out->start = befs16_to_cpu(fstype, iaddr->start);
+	out->len = befs16_to_cpu(fstype, iaddr->len);
 }
 
 
-static void befs_convert_inode (int fstype, befs_inode *inode, befs_inode * out)
+/*
+ * befs_read_data_runs
+ *
+ * description:
+ *  Keep block runs of data stream into inode.  Direct block runs up to the
+ *  first empty one, indirect and double indirect block are kept.  If they
+ *  are few, they are kept into inode itself.
+ *
+ * return value:
+ *  0 ... success
+ */
+
+static int befs_read_data_runs (struct inode * inode, int fstype,
+	befs_data_stream * ds)
 {
-	int i;
+	befs_block_run * runs;
+	int             count;
+	int             i;
 
-	/*
-	 * Convert data stream.
-	 */
+	for (count = 0; count < BEFS_NUM_DIRECT_BLOCKS; count++)
+		if (BEFS_IS_EMPTY_IADDR(&ds->direct[count]))
+			break;
 
-	switch (fstype)
-	{
-	case BEFS_X86:
-		out->magic1 = le32_to_cpu(inode->magic1);
-		befs_convert_inodeaddr (fstype, &inode->inode_num,
-			&out->inode_num);
-		out->uid = le32_to_cpu(inode->uid);
-		out->gid = le32_to_cpu(inode->gid);
-		out->mode = le32_to_cpu(inode->mode);
-		out->flags = le32_to_cpu(inode->flags);
-		out->create_time = le64_to_cpu(inode->create_time);
-		out->last_modified_time =
-			le64_to_cpu(inode->last_modified_time);
-		inode->type = le32_to_cpu(inode->type);
-		befs_convert_inodeaddr (fstype, &inode->parent, &out->parent);
-		befs_convert_inodeaddr (fstype, &inode->attributes,
-			&out->attributes);
-		out->inode_size = le32_to_cpu(inode->inode_size);
-
-		if (!S_ISLNK((umode_t) out->mode)) {
-			/*
-			 * Convert data stream.
-			 */
-
-			for ( i = 0; i < BEFS_NUM_DIRECT_BLOCKS; i++) {
-				befs_convert_inodeaddr (fstype,
-					&inode->data.datastream.direct[i],
-					&out->data.datastream.direct[i]);
-			}
-			befs_convert_inodeaddr (fstype,
-				&inode->data.datastream.indirect,
-				&out->data.datastream.indirect);
-			befs_convert_inodeaddr (fstype,
-				&inode->data.datastream.double_indirect,
-				&out->data.datastream.double_indirect);
-	
-			out->data.datastream.max_direct_range =
-				le64_to_cpu(inode->data.datastream.max_direct_range);
-			out->data.datastream.max_indirect_range =
-				le64_to_cpu(inode->data.datastream.max_indirect_range);
-			out->data.datastream.max_double_indirect_range =
-				le64_to_cpu(inode->data.datastream.max_double_indirect_range);
-			out->data.datastream.size =
-				le64_to_cpu(inode->data.datastream.size);
-		}
-		break;
-
-	case BEFS_PPC:
-		out->magic1 = be32_to_cpu(inode->magic1);
-		befs_convert_inodeaddr (fstype, &inode->inode_num,
-			&out->inode_num);
-		out->uid = be32_to_cpu(inode->uid);
-		out->gid = be32_to_cpu(inode->gid);
-		out->mode = be32_to_cpu(inode->mode);
-		out->flags = be32_to_cpu(inode->flags);
-		out->create_time = be64_to_cpu(inode->create_time);
-		out->last_modified_time =
-			be64_to_cpu(inode->last_modified_time);
-		out->type = be32_to_cpu(inode->type);
-		befs_convert_inodeaddr (fstype, &inode->parent, &out->parent);
-		befs_convert_inodeaddr (fstype, &inode->attributes,
-			&out->attributes);
-		out->inode_size = be32_to_cpu(inode->inode_size);
-
-		if (!S_ISLNK((umode_t) out->mode)) {
-
-			/*
-			 * Convert data stream.
-			 */
-
-			for ( i = 0; i < BEFS_NUM_DIRECT_BLOCKS; i++) {
-				befs_convert_inodeaddr (fstype,
-					&inode->data.datastream.direct[i],
-					&out->data.datastream.direct[i]);
-			}
-			befs_convert_inodeaddr (fstype,
-				&inode->data.datastream.indirect,
-				&out->data.datastream.indirect);
-			befs_convert_inodeaddr (fstype,
-				&inode->data.datastream.double_indirect,
-				&out->data.datastream.double_indirect);
-	
-			out->data.datastream.max_direct_range =
-				be64_to_cpu(inode->data.datastream.max_direct_range);
-			out->data.datastream.max_indirect_range =
-				be64_to_cpu(inode->data.datastream.max_indirect_range);
-			out->data.datastream.max_double_indirect_range =
-				be64_to_cpu(inode->data.datastream.max_double_indirect_range);
-			out->data.datastream.size =
-				be64_to_cpu(inode->data.datastream.size);
-		}
-		break;
+	if (count + 2 <= BEFS_INLINE_RUNS) {
+		runs = inode->u.befs_i.i_data.run;
+	} else {
+		runs = (befs_block_run *) kmalloc ((count + 2)
+			* sizeof(befs_block_run), GFP_KERNEL);
+		if (!runs)
+			return -ENOMEM;
+		BEFS_STAT_ALLOC(inode->i_sb, BEFS_ST_READ_INODE);
+
+		inode->u.befs_i.i_data.runs = runs;
+		inode->u.befs_i.i_inline = 0;
 	}
+	inode->u.befs_i.i_direct_count = count;
+
+	for (i = 0; i < count; i++)
+		befs_convert_inodeaddr (fstype, &ds->direct[i], &runs[i]);
+	befs_convert_inodeaddr (fstype, &ds->indirect, &runs[count]);
+	befs_convert_inodeaddr (fstype, &ds->double_indirect,
+		&runs[count + 1]);
+
+	return 0;
 }
 
 
 void befs_read_inode (struct inode * inode)
 {
 	struct buffer_head * bh = NULL;
-	befs_inode *          raw_inode = NULL;
 	befs_inode *          disk_inode;
+	int                  fstype;
+	__u32                mode;
+	__u32                flags;
+	__u32                inode_size;
+	char *               link;
+	int                  len;
+	cycles_t             start = BEFS_STAT_START();
 
 	BEFS_OUTPUT (("---> befs_read_inode() "
 		"inode = %lu[%lu, %u, %u]\n",
@@ -249,36 +190,33 @@ void befs_read_inode (struct inode * inode)
 			inode->u.befs_i.i_inode_num.len));
 	}
 
+	inode->u.befs_i.i_direct_count = 0;
+	inode->u.befs_i.i_inline = 1;
+	memset (&inode->u.befs_i.i_data, 0, sizeof(inode->u.befs_i.i_data));
+	inode->u.befs_i.i_index_cache = NULL;
+	inode->u.befs_i.i_indirect = NULL;
+	inode->u.befs_i.i_node_cache = NULL;
+	inode->u.befs_i.i_bloom = NULL;
+	inode->u.befs_i.i_small_data = NULL;
+	inode->u.befs_i.i_small_size = 0;
+
 	bh = befs_bread (inode);
 	if (!bh) {
 		printk (KERN_ERR "BEFS: unable to read inode block - "
 			"inode = %lu", inode->i_ino);
 		goto bad_inode;
 	}
+	BEFS_STAT_BREAD(inode->i_sb, BEFS_ST_READ_INODE, 1);
 
 	disk_inode = (befs_inode *) bh->b_data;
+	fstype = BEFS_TYPE(inode->i_sb);
 
-	/*
-	 * Convert little-endian or big-endian from befs type.
-	 */
-#ifdef CONFIG_BEFS_CONV
-	raw_inode = (befs_inode *) __getname();
-	if (!raw_inode) {
-		printk (KERN_ERR "BEFS: not allocate memory - inode = %lu",
-			inode->i_ino);
-		goto bad_inode;
-	}
-	befs_convert_inode (BEFS_TYPE(inode->i_sb), disk_inode, raw_inode);
-#else
-	raw_inode = disk_inode;
-#endif
-
-	BEFS_DUMP_INODE (raw_inode);
+	BEFS_DUMP_INODE (disk_inode);
 
 	/*
 	 * check magic header.
 	 */
-	if (raw_inode->magic1 != BEFS_INODE_MAGIC1) {
+	if (befs32_to_cpu(fstype, disk_inode->magic1) != BEFS_INODE_MAGIC1) {
 		printk (KERN_ERR
 			"BEFS: this inode is bad magic header - inode = %lu\n",
 			inode->i_ino);
@@ -289,15 +227,16 @@ void befs_read_inode (struct inode * inode)
 	 * check flag
 	 */
 
-	if (!(raw_inode->flags & BEFS_INODE_IN_USE) ||
-		(raw_inode->flags & BEFS_INODE_DELETED)) {
+	flags = befs32_to_cpu(fstype, disk_inode->flags);
+	if (!(flags & BEFS_INODE_IN_USE) || (flags & BEFS_INODE_DELETED)) {
 
 		printk (KERN_ERR "BEFS: inode is not used - inode = %lu\n",
 			inode->i_ino);
 		goto bad_inode;
 	}
 
-	inode->i_mode = (umode_t) raw_inode->mode;
+	mode = befs32_to_cpu(fstype, disk_inode->mode);
+	inode->i_mode = (umode_t) mode;
 
 	/*
 	 * set uid and gid.  But since current BeOS is single user OS, so
@@ -305,9 +244,11 @@ void befs_read_inode (struct inode * inode)
 	 */
 
 	inode->i_uid = inode->i_sb->u.befs_sb.mount_opts.uid ?
-		inode->i_sb->u.befs_sb.mount_opts.uid : (uid_t) raw_inode->uid;
+		inode->i_sb->u.befs_sb.mount_opts.uid
+		: (uid_t) befs32_to_cpu(fstype, disk_inode->uid);
 	inode->i_gid = inode->i_sb->u.befs_sb.mount_opts.gid ?
-		inode->i_sb->u.befs_sb.mount_opts.gid : (gid_t) raw_inode->gid;
+		inode->i_sb->u.befs_sb.mount_opts.gid
+		: (gid_t) befs32_to_cpu(fstype, disk_inode->gid);
 
 	inode->i_nlink = 1;
 
@@ -315,24 +256,39 @@ void befs_read_inode (struct inode * inode)
 	 * BEFS's time is 64 bits, but current VFS is 32 bits...
 	 */
 
-	inode->i_ctime = (time_t) (raw_inode->create_time >> 16);
-	inode->i_mtime = (time_t) (raw_inode->last_modified_time >> 16);
+	inode->i_ctime = (time_t) (befs64_to_cpu(fstype,
+		disk_inode->create_time) >> 16);
+	inode->i_mtime = (time_t) (befs64_to_cpu(fstype,
+		disk_inode->last_modified_time) >> 16);
 
 	/*
 	 * BEFS don't have access time.  So use last modified time.
 	 */
 
-	inode->i_atime = (time_t) (raw_inode->last_modified_time >> 16);
+	inode->i_atime = inode->i_mtime;
 
-	inode->i_blksize = raw_inode->inode_size;
-	inode->i_blocks = raw_inode->inode_size / inode->i_sb->s_blocksize;
+	inode_size = befs32_to_cpu(fstype, disk_inode->inode_size);
+	inode->i_blksize = inode_size;
+	inode->i_blocks = inode_size / inode->i_sb->s_blocksize;
 	inode->i_version = ++event;
 
-	inode->u.befs_i.i_inode_num = (befs_inode_addr) raw_inode->inode_num;
-	inode->u.befs_i.i_mode = raw_inode->mode;
-	inode->u.befs_i.i_flags = raw_inode->flags;
-	inode->u.befs_i.i_parent = (befs_inode_addr) raw_inode->parent;
-	inode->u.befs_i.i_attribute = (befs_inode_addr) raw_inode->attributes;
+	befs_convert_inodeaddr (fstype, &disk_inode->inode_num,
+		&inode->u.befs_i.i_inode_num);
+	befs_convert_inodeaddr (fstype, &disk_inode->parent,
+		&inode->u.befs_i.i_parent);
+	befs_convert_inodeaddr (fstype, &disk_inode->attributes,
+		&inode->u.befs_i.i_attribute);
+	inode->u.befs_i.i_type = befs32_to_cpu(fstype, disk_inode->type);
+
+	/*
+	 * Small data attributes are in this block.  Keep them now.
+	 */
+
+	if (befs_read_small_data (inode, fstype, disk_inode, inode_size)) {
+		printk (KERN_ERR "BEFS: cannot allocate memory - "
+			"inode = %lu\n", inode->i_ino);
+		goto bad_inode;
+	}
 
 	/*
 	 * Symbolic link have no data stream.
@@ -340,12 +296,33 @@ void befs_read_inode (struct inode * inode)
 	 */
 
 	if (!S_ISLNK(inode->i_mode)) {
-		inode->i_size = raw_inode->data.datastream.size;
-		inode->u.befs_i.i_data.ds = raw_inode->data.datastream;
+		if (befs_read_data_runs (inode, fstype,
+			&disk_inode->data.datastream)) {
+
+			printk (KERN_ERR "BEFS: cannot allocate memory - "
+				"inode = %lu\n", inode->i_ino);
+			goto bad_inode;
+		}
+		inode->i_size = befs64_to_cpu(fstype,
+			disk_inode->data.datastream.size);
 	} else {
+		for (len = 0; len < BEFS_SYMLINK_LEN
+			&& disk_inode->data.symlink[len]; len++)
+			;
+
+		link = (char *) kmalloc (len + 1, GFP_KERNEL);
+		if (!link) {
+			printk (KERN_ERR "BEFS: cannot allocate memory - "
+				"inode = %lu\n", inode->i_ino);
+			goto bad_inode;
+		}
+		BEFS_STAT_ALLOC(inode->i_sb, BEFS_ST_READ_INODE);
+		memcpy (link, disk_inode->data.symlink, len);
+		link[len] = '\0';
+
+		inode->u.befs_i.i_data.symlink = link;
+		inode->u.befs_i.i_inline = 0;
 		inode->i_size = 0;
-		memcpy (inode->u.befs_i.i_data.symlink, disk_inode->data.symlink,
-			BEFS_SYMLINK_LEN);
 	}
 
 	if (S_ISREG(inode->i_mode))
@@ -361,25 +338,53 @@ void befs_read_inode (struct inode * inode)
 	else if (S_ISFIFO(inode->i_mode))
 		init_fifo(inode);
 
-#ifdef CONFIG_BEFS_CONV
-	putname (raw_inode);
-#endif
 	brelse(bh);
+	befs_stat_end (inode->i_sb, BEFS_ST_READ_INODE, start);
+	BEFS_TRACE(BEFS_ST_READ_INODE, inode->i_ino,
+		&inode->u.befs_i.i_inode_num, start);
 
 	return;
 
 bad_inode:
 	make_bad_inode(inode);
-#ifdef CONFIG_BEFS_CONV
-	if (raw_inode)
-		putname (raw_inode);
-#endif
 	if (bh)
 		brelse(bh);
 
 	return;
 }
 
+/*
+ * befs_clear_inode
+ *
+ *  release in-core caches of inode.  This is called when the inode is
+ *  removed from inode cache.
+ */
+
+void befs_clear_inode (struct inode * inode)
+{
+	BEFS_OUTPUT (("---> befs_clear_inode() inode %lu\n", inode->i_ino));
+
+	befs_put_extent_map (inode);
+	befs_put_indirect_map (inode);
+	befs_put_node_cache (inode);
+	befs_put_bloom (inode);
+
+	/*
+	 * allocated block runs or link name
+	 */
+
+	if (!inode->u.befs_i.i_inline && inode->u.befs_i.i_data.runs) {
+		kfree (inode->u.befs_i.i_data.runs);
+		inode->u.befs_i.i_data.runs = NULL;
+	}
+
+	if (inode->u.befs_i.i_small_data) {
+		kfree (inode->u.befs_i.i_small_data);
+		inode->u.befs_i.i_small_data = NULL;
+	}
+}
+
+
 #ifdef CONFIG_BEFS_RW
 static int befs_update_inode(struct inode * inode, int do_sync)
 {
@@ -408,7 +413,6 @@ static int befs_update_inode(struct inode * inode, int do_sync)
 	raw_inode->gid = BEFS_DEFAULT_GID;
 
 	raw_inode->mode = inode->i_mode;
-	raw_inode->flags = inode->u.befs_i.i_flags;
 
 	raw_inode->create_time = ((__u64) inode->i_ctime) << 16;
 	raw_inode->last_modified_time = ((__u64) inode->i_mtime) << 16;
@@ -416,15 +420,12 @@ static int befs_update_inode(struct inode * inode, int do_sync)
 	raw_inode->parent = inode->u.befs_i.i_parent;
 	raw_inode->attributes = inode->u.befs_i.i_attribute;
 
-	raw_inode->type = inode->u.befs_i.i_type;
-
 	raw_inode->inode_size = inode->i_blksize;
 
-	if (!S_ISLNK(inode->i_mode))
-		raw_inode->data.datastream = inode->u.befs_i.i_data.ds;
-	else
-		memcpy (raw_inode->data.symlink, inode->u.befs_i.i_data.symlink,
-			BEFS_SYMLINK_LEN);
+	/*
+	 * flags, type and data stream are not kept in core, and are left as
+	 * they are on disk.
+	 */
 
 	mark_buffer_dirty (bh, 1);
 
@@ -0,0 +1,124 @@
+/*
+ *  linux/fs/befs/ioctl.c
+ *
+ * Copyright (C) 1999  Makoto Kato (m_kato@ga2.so-net.ne.jp)
+ *
+ *  ioctl of BEFS files and directories.
+ */
+
+#include <asm/uaccess.h>
+
+#include <linux/errno.h>
+#include <linux/fs.h>
+#include <linux/befs_fs.h>
+#include <linux/sched.h>
+#include <linux/stat.h>
+
+
+int befs_ioctl (struct inode * inode, struct file * filp, unsigned int cmd,
+	unsigned long arg)
+{
+	befs_attr_io    attr_io;
+	befs_index_scan scan_io;
+	befs_query      query;
+	befs_query_buf  query_buf;
+	befs_find_name  find_io;
+	befs_bulkstat_io bulk_io;
+	int            err;
+
+	BEFS_OUTPUT (("---> befs_ioctl() inode %lu cmd %08x\n",
+		inode->i_ino, cmd));
+
+	switch (cmd) {
+	case BEFS_IOC_GETATTR:
+	case BEFS_IOC_LISTATTR:
+		if (copy_from_user (&attr_io, (befs_attr_io *) arg,
+			sizeof(attr_io)))
+			return -EFAULT;
+		if (attr_io.size < 0)
+			return -EINVAL;
+
+		if (cmd == BEFS_IOC_GETATTR)
+			err = befs_getattr (inode, &attr_io);
+		else
+			err = befs_listattr (inode, &attr_io);
+
+		if (err >= 0 && copy_to_user (&((befs_attr_io *) arg)->type,
+			&attr_io.type, sizeof(attr_io.type)))
+			return -EFAULT;
+
+		return err;
+
+	case BEFS_IOC_SCAN:
+		if (!capable (CAP_SYS_ADMIN))
+			return -EPERM;
+		if (copy_from_user (&scan_io, (befs_index_scan *) arg,
+			sizeof(scan_io)))
+			return -EFAULT;
+
+		err = befs_scan_index (inode->i_sb, &scan_io);
+
+		if (err >= 0 && copy_to_user ((befs_index_scan *) arg,
+			&scan_io, sizeof(scan_io)))
+			return -EFAULT;
+
+		return err;
+
+	case BEFS_IOC_QUERY:
+
+		/*
+		 * Query is kept in file of root directory.
+		 */
+
+		if (inode != inode->i_sb->s_root->d_inode)
+			return -EINVAL;
+		if (!capable (CAP_SYS_ADMIN))
+			return -EPERM;
+		if (copy_from_user (&query, (befs_query *) arg, sizeof(query)))
+			return -EFAULT;
+
+		return befs_query_start (filp, &query);
+
+	case BEFS_IOC_QUERY_READ:
+		if (inode != inode->i_sb->s_root->d_inode)
+			return -EINVAL;
+		if (copy_from_user (&query_buf, (befs_query_buf *) arg,
+			sizeof(query_buf)))
+			return -EFAULT;
+
+		return befs_query_read (filp, &query_buf);
+
+	case BEFS_IOC_FINDNAME:
+		if (!capable (CAP_SYS_ADMIN))
+			return -EPERM;
+		if (copy_from_user (&find_io, (befs_find_name *) arg,
+			sizeof(find_io)))
+			return -EFAULT;
+
+		err = befs_lookup_name (inode->i_sb, &find_io);
+
+		if (err >= 0 && copy_to_user ((befs_find_name *) arg,
+			&find_io, sizeof(find_io)))
+			return -EFAULT;
+
+		return err;
+
+	case BEFS_IOC_BULKSTAT:
+		if (!capable (CAP_SYS_ADMIN))
+			return -EPERM;
+		if (copy_from_user (&bulk_io, (befs_bulkstat_io *) arg,
+			sizeof(bulk_io)))
+			return -EFAULT;
+
+		err = befs_bulkstat (inode->i_sb, &bulk_io);
+
+		if (err >= 0 && copy_to_user (&((befs_bulkstat_io *) arg)->pos,
+			&bulk_io.pos, sizeof(bulk_io.pos)))
+			return -EFAULT;
+
+		return err;
+
+	default:
+		return -ENOTTY;
+	}
+}
@@ -21,65 +21,46 @@
 #include <linux/string.h>
 #include <linux/locks.h>
 #include <linux/quotaops.h>
+#include <linux/malloc.h>
 
 
 /*
  * befs_find_entry
  *
  * description:
- *  find file or directry entry
+ *  find file or directry entry.  Descend B+tree of directory from root
+ *  node to leaf node.
  *
  * parameter:
  *  dir     ... parent's inode
  *  name    ... file or directry name
  *  namelen ... length of name
+ *
+ * return value:
+ *  inode number of entry, or 0 if not found.
  */
 
-static befs_off_t befs_find_entry (struct inode * dir, const char * const name,
+befs_off_t befs_find_entry (struct inode * dir, const char * const name,
 	int namelen)
 {
-	struct buffer_head *    bh;
-	befs_index_node *        bn;
-	struct super_block *    sb = dir->i_sb;
-	int                     sd_pos = 0;
+	befs_node *              node;
+	befs_index_entry         entry;
+	befs_off_t               node_off;
+	int                     level;
 	int                     key_pos;
-	char                    key[BEFS_NAME_LEN + 1];
-	int                     key_len;
-	befs_off_t               value;
+	befs_off_t               value = 0;
+	int                     err;
 
 	BEFS_OUTPUT (("---> befs_find_entry()\n"));
 
-	while (sd_pos >= 0) {
-		befs_data_stream * ds = &dir->u.befs_i.i_data.ds;
-		befs_inode_addr    iaddr;
-		int               flags;
-		befs_off_t         offset;
-
-		/*
-		 * get index node from small_data.
-		 *
-		 * First data stream has index entry, but other than it,
-		 * doesn't have it.  
-		 */
-
-		if (sd_pos)
-			flags = 1;
-		else
-			flags = 0;
-
-		iaddr = befs_read_data_stream (sb, ds, &sd_pos);
-		if (sd_pos <= 0) {
-			/*
-			 * cannot read next data stream
-			 */
+	if (befs_read_index_header (dir, &entry))
+		return 0;
 
-			BEFS_OUTPUT (("<--- befs_find_entry() "
-				"cannot read next data stream\n"));
-			return 0;
-		}
+	node_off = entry.root_node_pointer;
 
-		bh = befs_read_index_node (iaddr, sb, flags, &offset);
-		if (!bh) {
+	for (level = 0; level <= entry.max_number_of_levels; level++) {
+		node = befs_get_node (dir, node_off);
+		if (!node) {
 
 			/*
 			 * cannot read index node
@@ -90,35 +71,43 @@ static befs_off_t befs_find_entry (struct inode * dir, const char * const name,
 			return 0;
 		}
 
-		bn = (befs_index_node *) (bh->b_data + offset);
-
 		/*
-		 * explore in this block
+		 * find first key which is not less than name.
 		 */
 
-		key_pos = 0;
-		while (key_pos >= 0) {
+		err = befs_search_node (node, name, namelen, &key_pos, &value);
 
-			befs_get_key_from_index_node (bn, &key_pos,
-				BEFS_TYPE(sb), key, &key_len, &value);
-			if (key_pos < 0) {
-				BEFS_OUTPUT ((" not exist in this block\n"));
-				break;
-			}
+		if (node->overflow == BEFS_BT_NULL) {
 
-			if (!strcmp (key, name)) {
-				brelse (bh);
+			/*
+			 * leaf node
+			 */
 
+			befs_put_node (node);
+
+			if (!err) {
 				BEFS_OUTPUT (("<--- befs_find_entry() "
 					"value = %Lu\n", value));
 				return value;
 			}
+
+			BEFS_OUTPUT (("<--- befs_find_entry() not found\n"));
+			return 0;
 		}
 
-		brelse (bh);
+		/*
+		 * interior node.  Descend to child which has name.
+		 */
+
+		if (key_pos < node->all_key_count)
+			node_off = value;
+		else
+			node_off = node->overflow;
+
+		befs_put_node (node);
 	}
 
-	BEFS_OUTPUT (("<--- befs_find_entry() not found\n"));
+	BEFS_OUTPUT (("<--- befs_find_entry() too deep tree\n"));
 	return 0;
 }
 
@@ -129,28 +118,43 @@ int befs_lookup (struct inode * dir, struct dentry *dentry)
 	struct inode * inode = NULL;
 	befs_off_t      offset;
 	int            len;
-	char *         tmpname;
+	char *         name;
+	char           utfname[BEFS_NAME_LEN + 1];
+	cycles_t       start;
 
 	BEFS_OUTPUT (("---> befs_lookup() "
 		"name %s inode %ld\n", dentry->d_name.name, dir->i_ino));
 
-	/*
-	 * Convert to UTF-8
-	 */
+	if (BEFS_NAME_PASSTHROUGH(dir->i_sb)) {
+		name = (char *) dentry->d_name.name;
+		len = dentry->d_name.len;
+	} else {
 
-	if (!befs_nls2utf (dentry->d_name.name, dentry->d_name.len, &tmpname,
-		&len, dir->i_sb)) {
+		/*
+		 * Convert to UTF-8
+		 */
 
-		return -ENOMEM;
+		len = befs_nls2utf (dentry->d_name.name, dentry->d_name.len,
+			utfname, sizeof(utfname), dir->i_sb);
+		if (len < 0)
+			return len;
+		name = utfname;
 	}
 
-	if (len > BEFS_NAME_LEN) {
-		putname (tmpname);
+	if (len > BEFS_NAME_LEN)
 		return -ENAMETOOLONG;
-	}
 
-	offset = befs_find_entry (dir, tmpname, len);
-	putname (tmpname);
+	/*
+	 * Name filter of directory answers most of names which don't exist.
+	 */
+
+	if (befs_bloom_test (dir, name, len)) {
+		start = BEFS_STAT_START();
+		offset = befs_find_entry (dir, name, len);
+		befs_stat_end (dir->i_sb, BEFS_ST_FIND_ENTRY, start);
+		BEFS_TRACE(BEFS_ST_FIND_ENTRY, dir->i_ino, NULL, start);
+	} else
+		offset = 0;
 
 	if (offset) {
 		inode = iget (dir->i_sb, (ino_t) offset);
@@ -164,3 +168,231 @@ int befs_lookup (struct inode * dir, struct dentry *dentry)
 
 	return 0;
 }
+
+
+/*
+ * Records of BEFS_IOC_FINDNAME
+ */
+
+typedef struct _befs_find_buf {
+	struct super_block *	sb;
+	befs_scan *		scan;
+	char *			buf;
+	int			size;
+	int			len;
+	int			prefix;
+	int			done;
+	int			err;
+	befs_off_t		parent[BEFS_FIND_MAX_DEPTH];
+	char			name[BEFS_NAME_LEN + 1];
+} befs_find_buf;
+
+
+/*
+ * befs_parent_chain
+ *
+ * description:
+ *  Get inode numbers of parents of inode up to root directory.
+ *
+ * return value:
+ *  number of parents
+ */
+
+static int befs_parent_chain (struct super_block * sb, befs_off_t ino,
+	befs_off_t * parent)
+{
+	struct inode * inode;
+	befs_off_t      root;
+	befs_off_t      next;
+	int            depth = 0;
+
+	root = BEFS_IADDR2INO(&sb->u.befs_sb.root_dir, &sb->u.befs_sb);
+
+	while (ino != root && depth < BEFS_FIND_MAX_DEPTH) {
+		inode = iget (sb, (ino_t) ino);
+		if (!inode)
+			break;
+		if (is_bad_inode (inode)) {
+			iput (inode);
+			break;
+		}
+
+		next = BEFS_IADDR2INO(&inode->u.befs_i.i_parent,
+			&sb->u.befs_sb);
+		iput (inode);
+
+		if (next == ino)
+			break;
+		parent[depth++] = next;
+		ino = next;
+	}
+
+	return depth;
+}
+
+
+static int befs_find_fill (void * data, const char * key, int len,
+	befs_off_t ino)
+{
+	befs_find_buf * fb = (befs_find_buf *) data;
+	befs_scan *     scan = fb->scan;
+	befs_name_rec   rec;
+	const char *   name;
+	int            name_len;
+	int            depth;
+
+	/*
+	 * Keys after prefix end scan.
+	 */
+
+	if (fb->prefix && (len < scan->low_len
+		|| memcmp (key, scan->low, scan->low_len))) {
+		fb->done = 1;
+		return 1;
+	}
+
+	if (BEFS_NAME_PASSTHROUGH(fb->sb)) {
+		name = key;
+		name_len = len;
+	} else {
+		name_len = befs_utf2nls (key, len, fb->name, sizeof(fb->name),
+			fb->sb);
+		if (name_len < 0) {
+			fb->err = name_len;
+			return 1;
+		}
+		name = fb->name;
+	}
+
+	/*
+	 * Check space for the deepest chain before iget of parents, so that
+	 * a record which does not fit costs no inode read.
+	 */
+
+	if (fb->len + BEFS_NAME_REC_LEN(BEFS_FIND_MAX_DEPTH, name_len)
+		> fb->size)
+		return 1;
+
+	depth = befs_parent_chain (fb->sb, ino, fb->parent);
+
+	rec.ino = ino;
+	rec.rec_len = BEFS_NAME_REC_LEN(depth, name_len);
+	rec.depth = depth;
+	rec.name_len = name_len;
+	rec.pad = 0;
+
+	if (copy_to_user (fb->buf + fb->len, &rec, sizeof(rec))
+		|| copy_to_user (fb->buf + fb->len + sizeof(rec), fb->parent,
+		depth * sizeof(befs_off_t))
+		|| copy_to_user (fb->buf + fb->len + sizeof(rec)
+		+ depth * sizeof(befs_off_t), name, name_len)) {
+
+		fb->err = -EFAULT;
+		return 1;
+	}
+	fb->len += rec.rec_len;
+
+	return 0;
+}
+
+
+/*
+ * befs_lookup_name
+ *
+ * description:
+ *  BEFS_IOC_FINDNAME.  Look name up in name index of volume, instead of
+ *  walking all directories.
+ *
+ * return value:
+ *  length of records
+ */
+
+int befs_lookup_name (struct super_block * sb, befs_find_name * io)
+{
+	befs_scan *     scan;
+	befs_find_buf * fb;
+	char *         utfname;
+	int            len;
+	int            err;
+
+	if (io->name_len <= 0 || io->name_len > BEFS_NAME_LEN || io->size < 0)
+		return -EINVAL;
+	if (io->node == BEFS_BT_NULL)
+		return 0;
+
+	scan = (befs_scan *) kmalloc (sizeof(befs_scan) + sizeof(befs_find_buf),
+		GFP_KERNEL);
+	if (!scan)
+		return -ENOMEM;
+	fb = (befs_find_buf *) (scan + 1);
+
+	err = befs_scan_open (sb, "name", 4, scan);
+	if (err)
+		goto out;
+
+	if (scan->type != BEFS_STRING_TYPE) {
+		printk (KERN_ERR "BEFS: name index is not string - "
+			"inode = %lu\n", scan->index->i_ino);
+		err = -EIO;
+		goto close;
+	}
+
+	/*
+	 * Convert to UTF-8
+	 */
+
+	err = -EFAULT;
+	if (copy_from_user (fb->name, io->name, io->name_len))
+		goto close;
+
+	if (BEFS_NAME_PASSTHROUGH(sb)) {
+		utfname = fb->name;
+		len = io->name_len;
+	} else {
+		utfname = scan->high_buf;
+		len = befs_nls2utf (fb->name, io->name_len, utfname,
+			sizeof(scan->high_buf), sb);
+		err = len;
+		if (len < 0)
+			goto close;
+	}
+
+	err = befs_scan_range (scan, utfname, len, io->prefix ? NULL : utfname,
+		len);
+	if (err)
+		goto close;
+
+	err = befs_scan_position (scan, io->node, io->key, io->dup);
+	if (err)
+		goto close;
+
+	fb->sb = sb;
+	fb->scan = scan;
+	fb->buf = (char *) io->buf;
+	fb->size = io->size;
+	fb->len = 0;
+	fb->prefix = io->prefix;
+	fb->done = 0;
+	fb->err = 0;
+
+	err = befs_scan_next (scan, befs_find_fill, fb);
+	if (err > 0 && fb->err)
+		err = fb->err;
+	else if (err > 0 && fb->done)
+		scan->node = BEFS_BT_NULL;
+	else if (err > 0 && !fb->len)
+		err = -ERANGE;
+	if (err >= 0) {
+		io->node = scan->node;
+		io->key = scan->key;
+		io->dup = scan->dup;
+		err = fb->len;
+	}
+
+close:
+	befs_scan_close (scan);
+out:
+	kfree (scan);
+
+	return err;
+}
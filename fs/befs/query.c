@@ -0,0 +1,615 @@
+/*
+ *  linux/fs/befs/query.c
+ *
+ * Copyright (C) 1999  Makoto Kato (m_kato@ga2.so-net.ne.jp)
+ *
+ *  Query of BEFS like BeOS.  Each predicate is a range scan of an index,
+ *  and inodes which match all predicates are kept in the file of root
+ *  directory.  Only these inodes are read.
+ */
+
+#include <asm/uaccess.h>
+
+#include <linux/errno.h>
+#include <linux/fs.h>
+#include <linux/befs_fs.h>
+#include <linux/sched.h>
+#include <linux/stat.h>
+#include <linux/string.h>
+#include <linux/malloc.h>
+#include <linux/vmalloc.h>
+#include <linux/spinlock.h>
+
+
+/*
+ * Max number of inodes which match the first predicate
+ */
+
+#define BEFS_QUERY_MAX_INODES (1 << 20)
+#define BEFS_QUERY_MIN_INODES 1024
+#define BEFS_QUERY_WORD_BITS  (sizeof(unsigned long) * 8)
+
+/*
+ * Inodes of query
+ */
+
+typedef struct _befs_query_set {
+	befs_off_t *	ino;		/* sorted inode numbers */
+	int		count;		/* number of inodes */
+	int		max;		/* allocated number of inodes */
+	int		pos;		/* next inode to read */
+	int		users;		/* number of readers */
+	unsigned long *	hit;		/* inodes matched by predicate */
+} befs_query_set;
+
+/*
+ * befs_query_lock protects query of file (private_data), and pos and
+ * users of it.  Query is read without lock held, because iget and
+ * copy_to_user may sleep.  A query which is being read is freed by the
+ * last reader.
+ */
+
+static spinlock_t befs_query_lock = SPIN_LOCK_UNLOCKED;
+
+/*
+ * Scan of one predicate
+ */
+
+typedef struct _befs_query_scan {
+	befs_scan	scan;
+	befs_query_set * set;
+	int		op;
+	int		first;		/* the first predicate collects inodes */
+	int		prefix_len;	/* length of pattern before wildcard */
+	int		done;		/* keys after prefix */
+	int		err;
+	char		pattern[BEFS_NAME_LEN + 1];
+	int		pattern_len;
+} befs_query_scan;
+
+
+/*
+ * befs_query_rank
+ *
+ * description:
+ *  Predicates which match fewer inodes are evaluated first.  Pattern
+ *  which starts with wildcard scans whole index.
+ */
+
+static int befs_query_rank (befs_query_pred * pred)
+{
+	char c = '*';
+
+	switch (pred->op) {
+	case BEFS_QUERY_EQ:
+		return 0;
+	case BEFS_QUERY_MATCH:
+		if (pred->key_len > 0 && get_user (c, (char *) pred->key))
+			return 3;
+		return (c == '*' || c == '?') ? 3 : 1;
+	}
+
+	return 2;
+}
+
+
+/*
+ * befs_match
+ *
+ * description:
+ *  Match string with pattern.  '*' matches any bytes, and '?' matches
+ *  one byte.
+ */
+
+static int befs_match (const char * pat, int plen, const char * str, int slen)
+{
+	int pi = 0;
+	int si = 0;
+	int star = -1;
+	int mark = 0;
+
+	while (si < slen) {
+		if (pi < plen && pat[pi] == '*') {
+			star = pi++;
+			mark = si;
+		} else if (pi < plen && (pat[pi] == '?' || pat[pi] == str[si])) {
+			pi++;
+			si++;
+		} else if (star >= 0) {
+			pi = star + 1;
+			si = ++mark;
+		} else
+			return 0;
+	}
+
+	while (pi < plen && pat[pi] == '*')
+		pi++;
+
+	return pi == plen;
+}
+
+
+static void befs_sift_ino (befs_off_t * ino, int i, int n)
+{
+	befs_off_t t = ino[i];
+	int       c;
+
+	while ((c = 2 * i + 1) < n) {
+		if (c + 1 < n && ino[c + 1] > ino[c])
+			c++;
+		if (t >= ino[c])
+			break;
+		ino[i] = ino[c];
+		i = c;
+	}
+	ino[i] = t;
+}
+
+
+/*
+ * befs_sort_ino
+ *
+ * description:
+ *  Sort inode numbers (heap sort), and remove same numbers.
+ *
+ * return value:
+ *  number of inodes
+ */
+
+static int befs_sort_ino (befs_off_t * ino, int n)
+{
+	befs_off_t t;
+	int       i;
+	int       j;
+
+	for (i = n / 2 - 1; i >= 0; i--)
+		befs_sift_ino (ino, i, n);
+	for (i = n - 1; i > 0; i--) {
+		t = ino[0];
+		ino[0] = ino[i];
+		ino[i] = t;
+		befs_sift_ino (ino, 0, i);
+	}
+
+	for (i = j = 0; i < n; i++) {
+		if (!j || ino[i] != ino[j - 1])
+			ino[j++] = ino[i];
+	}
+
+	return j;
+}
+
+
+/*
+ * befs_query_add
+ *
+ * description:
+ *  Add inode to query.  Array of inodes grows twice.
+ */
+
+static int befs_query_add (befs_query_set * set, befs_off_t ino)
+{
+	befs_off_t * new;
+	int         max;
+
+	if (set->count == set->max) {
+		if (set->max >= BEFS_QUERY_MAX_INODES)
+			return -E2BIG;
+
+		max = set->max ? set->max * 2 : BEFS_QUERY_MIN_INODES;
+		new = (befs_off_t *) vmalloc (max * sizeof(befs_off_t));
+		if (!new)
+			return -ENOMEM;
+
+		if (set->ino) {
+			memcpy (new, set->ino, set->count * sizeof(befs_off_t));
+			vfree (set->ino);
+		}
+		set->ino = new;
+		set->max = max;
+	}
+
+	set->ino[set->count++] = ino;
+
+	return 0;
+}
+
+
+/*
+ * befs_query_fill
+ *
+ * description:
+ *  Called for each key and inode of predicate.  The first predicate adds
+ *  inodes, and the others mark inodes which are already in query.
+ */
+
+static int befs_query_fill (void * data, const char * key, int len,
+	befs_off_t ino)
+{
+	befs_query_scan * qs = (befs_query_scan *) data;
+	befs_query_set *  set = qs->set;
+	int              lo;
+	int              hi;
+	int              mid;
+
+	switch (qs->op) {
+	case BEFS_QUERY_LT:
+		if (!befs_compare_typed (&qs->scan, key, len, qs->scan.high,
+			qs->scan.high_len))
+			return 0;
+		break;
+	case BEFS_QUERY_GT:
+		if (!befs_compare_typed (&qs->scan, key, len, qs->scan.low,
+			qs->scan.low_len))
+			return 0;
+		break;
+	case BEFS_QUERY_MATCH:
+		if (len < qs->prefix_len
+			|| memcmp (key, qs->pattern, qs->prefix_len)) {
+			qs->done = 1;
+			return 1;
+		}
+		if (!befs_match (qs->pattern, qs->pattern_len, key, len))
+			return 0;
+		break;
+	}
+
+	if (qs->first) {
+		qs->err = befs_query_add (set, ino);
+		return qs->err;
+	}
+
+	lo = 0;
+	hi = set->count - 1;
+	while (lo <= hi) {
+		mid = (lo + hi) >> 1;
+
+		if (set->ino[mid] < ino)
+			lo = mid + 1;
+		else if (set->ino[mid] > ino)
+			hi = mid - 1;
+		else {
+			set->hit[mid / BEFS_QUERY_WORD_BITS] |=
+				1UL << (mid % BEFS_QUERY_WORD_BITS);
+			break;
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ * befs_query_eval
+ *
+ * description:
+ *  Evaluate predicate, and leave inodes which match it in query.
+ */
+
+static int befs_query_eval (struct super_block * sb, befs_query_pred * pred,
+	befs_query_scan * qs)
+{
+	befs_query_set * set = qs->set;
+	befs_scan *      scan = &qs->scan;
+	char            name[BEFS_NAME_LEN + 1];
+	char *          key = qs->pattern;
+	int             len = pred->key_len;
+	int             size;
+	int             err;
+	int             i;
+	int             j;
+
+	if (pred->index_len <= 0 || pred->index_len > BEFS_NAME_LEN
+		|| len < 0 || len > BEFS_NAME_LEN
+		|| pred->op < BEFS_QUERY_EQ || pred->op > BEFS_QUERY_MATCH)
+		return -EINVAL;
+	if (copy_from_user (name, pred->index, pred->index_len))
+		return -EFAULT;
+
+	err = befs_scan_open (sb, name, pred->index_len, scan);
+	if (err)
+		return err;
+
+	/*
+	 * Keys of name index are in iocharset, as names of readdir and
+	 * BEFS_IOC_FINDNAME.  name is free after open.
+	 */
+
+	if (pred->index_len == 4 && !memcmp (name, "name", 4)
+		&& !BEFS_NAME_PASSTHROUGH(sb)) {
+
+		err = -EFAULT;
+		if (copy_from_user (name, pred->key, len))
+			goto close;
+		len = befs_nls2utf (name, len, key, sizeof(qs->pattern), sb);
+		err = len;
+		if (len < 0)
+			goto close;
+	} else {
+		err = -EFAULT;
+		if (copy_from_user (key, pred->key, len))
+			goto close;
+	}
+
+	qs->op = pred->op;
+	qs->done = 0;
+	qs->err = 0;
+
+	switch (pred->op) {
+	case BEFS_QUERY_EQ:
+		err = befs_scan_range (scan, key, len, key, len);
+		break;
+	case BEFS_QUERY_LT:
+	case BEFS_QUERY_LE:
+		err = befs_scan_range (scan, NULL, 0, key, len);
+		break;
+	case BEFS_QUERY_GT:
+	case BEFS_QUERY_GE:
+		err = befs_scan_range (scan, key, len, NULL, 0);
+		break;
+	case BEFS_QUERY_MATCH:
+		if (scan->type != BEFS_STRING_TYPE) {
+			err = -EINVAL;
+			break;
+		}
+
+		/*
+		 * Keys which have the same prefix are scanned.
+		 */
+
+		for (i = 0; i < len && key[i] != '*' && key[i] != '?'; i++)
+			;
+		qs->prefix_len = i;
+		qs->pattern_len = len;
+		err = befs_scan_range (scan, i ? key : NULL, i, NULL, 0);
+		break;
+	}
+	if (err)
+		goto close;
+
+	if (!qs->first) {
+		size = (set->count + BEFS_QUERY_WORD_BITS - 1)
+			/ BEFS_QUERY_WORD_BITS * sizeof(unsigned long);
+		set->hit = (unsigned long *) vmalloc (size);
+		if (!set->hit) {
+			err = -ENOMEM;
+			goto close;
+		}
+		memset (set->hit, 0, size);
+	}
+
+	err = befs_scan_next (scan, befs_query_fill, qs);
+	if (err > 0)
+		err = qs->err;
+	if (err)
+		goto close;
+
+	if (qs->first) {
+		set->count = befs_sort_ino (set->ino, set->count);
+	} else {
+
+		/*
+		 * leave marked inodes
+		 */
+
+		for (i = j = 0; i < set->count; i++) {
+			if (set->hit[i / BEFS_QUERY_WORD_BITS]
+				& (1UL << (i % BEFS_QUERY_WORD_BITS)))
+				set->ino[j++] = set->ino[i];
+		}
+		set->count = j;
+	}
+
+close:
+	if (set->hit) {
+		vfree (set->hit);
+		set->hit = NULL;
+	}
+	befs_scan_close (scan);
+
+	return err;
+}
+
+
+static void befs_query_free (befs_query_set * set)
+{
+	if (set->ino)
+		vfree (set->ino);
+	if (set->hit)
+		vfree (set->hit);
+	kfree (set);
+}
+
+
+/*
+ * befs_query_set_file
+ *
+ * description:
+ *  Replace query of file by set.  Old query is freed unless it is being
+ *  read.
+ */
+
+static void befs_query_set_file (struct file * filp, befs_query_set * set)
+{
+	befs_query_set * old;
+
+	spin_lock (&befs_query_lock);
+	old = (befs_query_set *) filp->private_data;
+	filp->private_data = set;
+	if (old && old->users)
+		old = NULL;
+	spin_unlock (&befs_query_lock);
+
+	if (old)
+		befs_query_free (old);
+}
+
+
+/*
+ * befs_query_start
+ *
+ * description:
+ *  BEFS_IOC_QUERY.  Evaluate all predicates, and keep inodes which match
+ *  them in file.  Previous query of file is dropped.
+ */
+
+int befs_query_start (struct file * filp, befs_query * query)
+{
+	struct super_block * sb = filp->f_dentry->d_inode->i_sb;
+	befs_query_pred      pred[BEFS_QUERY_MAX_PRED];
+	int                  rank[BEFS_QUERY_MAX_PRED];
+	befs_query_pred      t;
+	int                  tr;
+	befs_query_set *     set;
+	befs_query_scan *    qs;
+	int                  err = 0;
+	int                  i;
+	int                  j;
+
+	if (query->count <= 0 || query->count > BEFS_QUERY_MAX_PRED)
+		return -EINVAL;
+	if (copy_from_user (pred, query->pred,
+		query->count * sizeof(befs_query_pred)))
+		return -EFAULT;
+
+	for (i = 0; i < query->count; i++)
+		rank[i] = befs_query_rank (&pred[i]);
+
+	for (i = 1; i < query->count; i++) {
+		t = pred[i];
+		tr = rank[i];
+		for (j = i; j > 0 && rank[j - 1] > tr; j--) {
+			pred[j] = pred[j - 1];
+			rank[j] = rank[j - 1];
+		}
+		pred[j] = t;
+		rank[j] = tr;
+	}
+
+	set = (befs_query_set *) kmalloc (sizeof(befs_query_set), GFP_KERNEL);
+	if (!set)
+		return -ENOMEM;
+	memset (set, 0, sizeof(befs_query_set));
+
+	qs = (befs_query_scan *) kmalloc (sizeof(befs_query_scan), GFP_KERNEL);
+	if (!qs) {
+		befs_query_free (set);
+		return -ENOMEM;
+	}
+	qs->set = set;
+
+	for (i = 0; i < query->count; i++) {
+		qs->first = !i;
+		err = befs_query_eval (sb, &pred[i], qs);
+		if (err || !set->count)
+			break;
+	}
+
+	kfree (qs);
+
+	if (err) {
+		befs_query_free (set);
+		return err;
+	}
+
+	befs_query_set_file (filp, set);
+
+	return 0;
+}
+
+
+/*
+ * befs_query_read
+ *
+ * description:
+ *  BEFS_IOC_QUERY_READ.  Read next inodes of query, and fill records.
+ *  Inodes which are not used now are skipped.
+ *
+ * return value:
+ *  number of records
+ */
+
+int befs_query_read (struct file * filp, befs_query_buf * io)
+{
+	struct super_block * sb = filp->f_dentry->d_inode->i_sb;
+	befs_query_set *     set;
+	struct inode *       inode;
+	befs_query_rec       rec;
+	befs_off_t            ino;
+	int                  n = 0;
+	int                  err = 0;
+	int                  last;
+
+	if (io->count < 0)
+		return -EINVAL;
+
+	spin_lock (&befs_query_lock);
+	set = (befs_query_set *) filp->private_data;
+	if (set)
+		set->users++;
+	spin_unlock (&befs_query_lock);
+
+	if (!set)
+		return -EINVAL;
+
+	while (n < io->count) {
+		spin_lock (&befs_query_lock);
+		if (set->pos >= set->count) {
+			spin_unlock (&befs_query_lock);
+			break;
+		}
+		ino = set->ino[set->pos++];
+		spin_unlock (&befs_query_lock);
+
+		inode = iget (sb, (ino_t) ino);
+		if (!inode)
+			continue;
+		if (is_bad_inode (inode)) {
+			iput (inode);
+			continue;
+		}
+
+		rec.ino = inode->i_ino;
+		rec.parent = BEFS_IADDR2INO(&inode->u.befs_i.i_parent,
+			&sb->u.befs_sb);
+		rec.size = inode->i_size;
+		rec.mode = inode->i_mode;
+		rec.uid = inode->i_uid;
+		rec.gid = inode->i_gid;
+		rec.mtime = inode->i_mtime;
+		iput (inode);
+
+		if (copy_to_user (io->rec + n, &rec, sizeof(rec))) {
+			err = -EFAULT;
+			break;
+		}
+		n++;
+	}
+
+	/*
+	 * If query of file was replaced while reading, the last reader
+	 * frees it.
+	 */
+
+	spin_lock (&befs_query_lock);
+	last = !--set->users && filp->private_data != set;
+	spin_unlock (&befs_query_lock);
+
+	if (last)
+		befs_query_free (set);
+
+	return err ? err : n;
+}
+
+
+/*
+ * befs_query_release
+ *
+ * description:
+ *  Drop query of file.  This is called when the file is closed.
+ */
+
+void befs_query_release (struct file * filp)
+{
+	befs_query_set_file (filp, NULL);
+}
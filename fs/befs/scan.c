@@ -0,0 +1,683 @@
+/*
+ *  linux/fs/befs/scan.c
+ *
+ * Copyright (C) 1999  Makoto Kato (m_kato@ga2.so-net.ne.jp)
+ *
+ *  Range scan over indices of volume (name, size, last_modified and
+ *  indices made by user).  They are B+trees like directory, but keys
+ *  are typed and a key may have many values.
+ */
+
+#include <asm/uaccess.h>
+
+#include <linux/errno.h>
+#include <linux/fs.h>
+#include <linux/befs_fs.h>
+#include <linux/sched.h>
+#include <linux/stat.h>
+#include <linux/string.h>
+#include <linux/locks.h>
+#include <linux/malloc.h>
+
+
+/*
+ * befs_key_size
+ *
+ * description:
+ *  Size of numeric key type, or 0 for string.
+ */
+
+static int befs_key_size (int type)
+{
+	switch (type) {
+	case BEFS_INT32_TYPE:
+	case BEFS_UINT32_TYPE:
+	case BEFS_FLOAT_TYPE:
+		return 4;
+	case BEFS_INT64_TYPE:
+	case BEFS_UINT64_TYPE:
+	case BEFS_DOUBLE_TYPE:
+		return 8;
+	}
+
+	return 0;
+}
+
+
+/*
+ * befs_key_order
+ *
+ * description:
+ *  Map numeric key to unsigned 64 bits integer of the same order.
+ *  Signed integers are biased, and IEEE floating points flip negative
+ *  values, so no floating point operation is used.
+ *
+ * parameter:
+ *  type   ... key type
+ *  fstype ... byte order of key
+ *  key    ... key (maybe unaligned)
+ */
+
+static __u64 befs_key_order (int type, int fstype, const char * key)
+{
+	__u32 v32;
+	__u64 v64;
+
+	if (befs_key_size (type) == 4) {
+		memcpy (&v32, key, 4);
+		v32 = befs32_to_cpu(fstype, v32);
+
+		switch (type) {
+		case BEFS_INT32_TYPE:
+			return v32 ^ 0x80000000;
+		case BEFS_FLOAT_TYPE:
+			return (v32 & 0x80000000) ? (__u32) ~v32
+				: (v32 | 0x80000000);
+		}
+		return v32;
+	}
+
+	memcpy (&v64, key, 8);
+	v64 = befs64_to_cpu(fstype, v64);
+
+	switch (type) {
+	case BEFS_INT64_TYPE:
+		return v64 ^ 0x8000000000000000ULL;
+	case BEFS_DOUBLE_TYPE:
+		return (v64 & 0x8000000000000000ULL) ? ~v64
+			: (v64 | 0x8000000000000000ULL);
+	}
+	return v64;
+}
+
+
+/*
+ * befs_compare_typed
+ *
+ * description:
+ *  Compare key of index with key in CPU byte order.
+ *
+ * return value:
+ *  < 0 ... key1 is less than key2
+ *  0   ... key1 equals key2
+ *  > 0 ... key1 is greater than key2
+ */
+
+int befs_compare_typed (befs_scan * scan, const char * key1, int len1,
+	const char * key2, int len2)
+{
+	int   size = befs_key_size (scan->type);
+	__u64 v1;
+	__u64 v2;
+
+	if (!size || len1 != size)
+		return befs_compare_key (key1, len1, key2, len2);
+
+	v1 = befs_key_order (scan->type, BEFS_TYPE(scan->index->i_sb), key1);
+	v2 = befs_key_order (scan->type, BEFS_NATIVE_TYPE, key2);
+
+	if (v1 < v2)
+		return -1;
+
+	return v1 > v2;
+}
+
+
+/*
+ * befs_scan_key
+ *
+ * description:
+ *  Copy key of index to buf in CPU byte order.
+ *
+ * return value:
+ *  length of key
+ */
+
+int befs_scan_key (befs_scan * scan, const char * key, int len, char * buf)
+{
+	int   fstype = BEFS_TYPE(scan->index->i_sb);
+	int   size = befs_key_size (scan->type);
+	__u32 v32;
+	__u64 v64;
+
+	if (size == 4 && len == 4) {
+		memcpy (&v32, key, 4);
+		v32 = befs32_to_cpu(fstype, v32);
+		memcpy (buf, &v32, 4);
+	} else if (size == 8 && len == 8) {
+		memcpy (&v64, key, 8);
+		v64 = befs64_to_cpu(fstype, v64);
+		memcpy (buf, &v64, 8);
+	} else
+		memcpy (buf, key, len);
+
+	return len;
+}
+
+
+/*
+ * befs_scan_open
+ *
+ * description:
+ *  Open index name of volume for range scan.  The range is whole index
+ *  until befs_scan_range is called.
+ *
+ * return value:
+ *  0       ... success
+ *  -ENOENT ... no such index
+ */
+
+int befs_scan_open (struct super_block * sb, const char * name, int len,
+	befs_scan * scan)
+{
+	struct inode *   dir;
+	befs_index_entry  entry;
+	befs_off_t        ino;
+
+	memset (scan, 0, sizeof(befs_scan));
+
+	if (BEFS_IS_EMPTY_IADDR(&sb->u.befs_sb.indices))
+		return -ENOENT;
+
+	dir = iget (sb, BEFS_IADDR2INO(&sb->u.befs_sb.indices,
+		&sb->u.befs_sb));
+	if (!dir)
+		return -EIO;
+	if (is_bad_inode (dir) || !S_ISDIR(dir->i_mode)) {
+		iput (dir);
+		return -EIO;
+	}
+
+	ino = befs_find_entry (dir, name, len);
+	iput (dir);
+	if (!ino)
+		return -ENOENT;
+
+	scan->index = iget (sb, (ino_t) ino);
+	if (!scan->index)
+		return -EIO;
+	if (is_bad_inode (scan->index)
+		|| befs_read_index_header (scan->index, &entry)) {
+
+		befs_scan_close (scan);
+		return -EIO;
+	}
+
+	if (entry.max_number_of_levels > BEFS_BT_MAX_LEVELS) {
+		befs_scan_close (scan);
+		return -EIO;
+	}
+
+	if (entry.data_type > BEFS_DOUBLE_TYPE) {
+		printk (KERN_ERR "BEFS: unknown key type of index - "
+			"inode = %lu\n", scan->index->i_ino);
+		befs_scan_close (scan);
+		return -EIO;
+	}
+
+	/*
+	 * Node size is power of 2 (checked by befs_read_index_header).  Use
+	 * shift and mask with 64 bits offsets.
+	 */
+
+	scan->type = entry.data_type;
+	scan->node_size = entry.node_size;
+	while ((1 << scan->node_shift) < scan->node_size)
+		scan->node_shift++;
+	scan->root = entry.root_node_pointer;
+	scan->levels = (int) entry.max_number_of_levels;
+
+	return 0;
+}
+
+
+/*
+ * befs_scan_range
+ *
+ * description:
+ *  Set range of scan.  low and high are in CPU byte order, and either may
+ *  be NULL for no limit.
+ *
+ * return value:
+ *  0       ... success
+ *  -EINVAL ... length of key does not match key type
+ */
+
+int befs_scan_range (befs_scan * scan, const char * low, int low_len,
+	const char * high, int high_len)
+{
+	int size = befs_key_size (scan->type);
+
+	if ((low && (low_len < 0 || low_len > BEFS_NAME_LEN
+		|| (size && low_len != size)))
+		|| (high && (high_len < 0 || high_len > BEFS_NAME_LEN
+		|| (size && high_len != size))))
+		return -EINVAL;
+
+	scan->low = NULL;
+	scan->high = NULL;
+	if (low) {
+		if (low != scan->low_buf)
+			memcpy (scan->low_buf, low, low_len);
+		scan->low = scan->low_buf;
+		scan->low_len = low_len;
+	}
+	if (high) {
+		if (high != scan->high_buf)
+			memcpy (scan->high_buf, high, high_len);
+		scan->high = scan->high_buf;
+		scan->high_len = high_len;
+	}
+
+	scan->node = 0;
+	scan->key = 0;
+	scan->dup = 0;
+
+	return 0;
+}
+
+
+void befs_scan_close (befs_scan * scan)
+{
+	if (scan->index) {
+		iput (scan->index);
+		scan->index = NULL;
+	}
+}
+
+
+/*
+ * befs_scan_seek
+ *
+ * description:
+ *  Descend B+tree to the first key which is not less than low.
+ */
+
+static int befs_scan_seek (befs_scan * scan)
+{
+	befs_node *  node;
+	befs_off_t   node_off = scan->root;
+	char *      key;
+	int         level;
+	int         len;
+	int         lo;
+	int         hi;
+	int         mid;
+
+	for (level = 0; level <= scan->levels; level++) {
+		node = befs_get_node (scan->index, node_off);
+		if (!node)
+			return -EIO;
+
+		lo = 0;
+		hi = node->all_key_count - 1;
+		while (scan->low && lo <= hi) {
+			mid = (lo + hi) >> 1;
+			key = BEFS_NODE_KEY(node, mid, len);
+
+			if (befs_compare_typed (scan, key, len, scan->low,
+				scan->low_len) < 0)
+				lo = mid + 1;
+			else
+				hi = mid - 1;
+		}
+
+		if (node->overflow == BEFS_BT_NULL) {
+			befs_put_node (node);
+
+			scan->node = node_off;
+			scan->key = lo;
+			scan->dup = 0;
+			return 0;
+		}
+
+		if (lo < node->all_key_count)
+			node_off = node->value[lo];
+		else
+			node_off = node->overflow;
+
+		befs_put_node (node);
+	}
+
+	return -EIO;
+}
+
+
+/*
+ * befs_scan_dups
+ *
+ * description:
+ *  Call fn for values of duplicate key from scan->dup.
+ *
+ * return value:
+ *  0 ... all values done
+ *  1 ... fn stopped scan
+ */
+
+static int befs_scan_dups (befs_scan * scan, const char * key, int len,
+	befs_off_t link, befs_scan_fn fn, void * data)
+{
+	struct buffer_head * bh;
+	befs_index_node *     bn;
+	befs_off_t *          array;
+	befs_off_t            offset = BEFS_BT_FRAGMENT_OFFSET(link);
+	befs_off_t            next;
+	int                  fstype = BEFS_TYPE(scan->index->i_sb);
+	int                  count;
+	int                  max;
+	int                  n = 0;
+	int                  i;
+	befs_off_t            nodes;
+
+	/*
+	 * Chain of duplicate nodes is not longer than number of nodes.
+	 */
+
+	for (nodes = scan->index->i_size >> scan->node_shift; nodes >= 0;
+		nodes--) {
+
+		bh = befs_read_node (scan->index, offset, &bn);
+		if (!bh)
+			return -EIO;
+
+		if (BEFS_BT_LINK_TYPE(link) == BEFS_BT_DUP_FRAGMENT) {
+			array = (befs_off_t *) bn + BEFS_BT_FRAGMENT_INDEX(link)
+				* (BEFS_BT_FRAGMENT_VALUES + 1);
+			max = BEFS_BT_FRAGMENT_VALUES;
+			next = BEFS_BT_NULL;
+
+			if ((char *) (array + max + 1) - (char *) bn
+				> scan->node_size)
+				max = -1;
+		} else {
+			array = &bn->overflow;
+			max = (scan->node_size - 3 * sizeof(befs_off_t))
+				/ sizeof(befs_off_t);
+			next = befs64_to_cpu(fstype, bn->right);
+		}
+
+		count = (int) befs64_to_cpu(fstype, array[0]);
+		if (count < 0 || count > max) {
+			printk (KERN_ERR "BEFS: duplicate of index is broken - "
+				"inode = %lu\n", scan->index->i_ino);
+			brelse (bh);
+			return -EIO;
+		}
+
+		for (i = 0; i < count; i++, n++) {
+			if (n < scan->dup)
+				continue;
+			if (fn (data, key, len,
+				befs64_to_cpu(fstype, array[i + 1]))) {
+				brelse (bh);
+				return 1;
+			}
+			scan->dup = n + 1;
+		}
+
+		brelse (bh);
+
+		if (next == BEFS_BT_NULL)
+			return 0;
+		offset = next;
+	}
+
+	printk (KERN_ERR "BEFS: loop in duplicate nodes of index - "
+		"inode = %lu\n", scan->index->i_ino);
+
+	return -EIO;
+}
+
+
+/*
+ * befs_scan_position
+ *
+ * description:
+ *  Set position of scan given by user.  node must be 0 (start of range)
+ *  or offset of a node in index.
+ *
+ * return value:
+ *  0       ... success
+ *  -EINVAL ... bad position
+ */
+
+int befs_scan_position (befs_scan * scan, befs_off_t node, int key, int dup)
+{
+	if (key < 0 || dup < 0)
+		return -EINVAL;
+	if (node && (node < 0 || node >= scan->index->i_size
+		|| (node & (scan->node_size - 1))))
+		return -EINVAL;
+
+	scan->node = node;
+	scan->key = key;
+	scan->dup = dup;
+
+	return 0;
+}
+
+
+/*
+ * befs_scan_next
+ *
+ * description:
+ *  Call fn for each key and value from current position to high.
+ *  Position is kept in scan, and next call continues from it.
+ *
+ * return value:
+ *  0 ... end of range (scan->node is BEFS_BT_NULL)
+ *  1 ... fn stopped scan
+ */
+
+int befs_scan_next (befs_scan * scan, befs_scan_fn fn, void * data)
+{
+	befs_node *  node;
+	befs_off_t   value;
+	befs_off_t   next;
+	char *      key;
+	int         len;
+	int         err;
+
+	if (!scan->node) {
+		err = befs_scan_seek (scan);
+		if (err)
+			return err;
+	}
+
+	while (scan->node != BEFS_BT_NULL) {
+		node = befs_get_node (scan->index, scan->node);
+		if (!node)
+			return -EIO;
+
+		if (node->overflow != BEFS_BT_NULL) {
+			printk (KERN_ERR "BEFS: not leaf node in leaf chain - "
+				"inode = %lu\n", scan->index->i_ino);
+			befs_put_node (node);
+			return -EIO;
+		}
+
+		if (node->right != BEFS_BT_NULL)
+			befs_prefetch_stream (scan->index, node->right);
+
+		for (; scan->key < node->all_key_count;
+			scan->key++, scan->dup = 0) {
+
+			key = BEFS_NODE_KEY(node, scan->key, len);
+			if (len > BEFS_NAME_LEN) {
+				printk (KERN_ERR "BEFS: too long key of index "
+					"- inode = %lu\n", scan->index->i_ino);
+				befs_put_node (node);
+				return -EIO;
+			}
+
+			if (scan->high && befs_compare_typed (scan, key, len,
+				scan->high, scan->high_len) > 0) {
+
+				befs_put_node (node);
+				scan->node = BEFS_BT_NULL;
+				return 0;
+			}
+
+			value = node->value[scan->key];
+			switch (BEFS_BT_LINK_TYPE(value)) {
+			case BEFS_BT_DUP_NODE:
+			case BEFS_BT_DUP_FRAGMENT:
+				err = befs_scan_dups (scan, key, len, value,
+					fn, data);
+				if (err) {
+					befs_put_node (node);
+					return err;
+				}
+				break;
+			default:
+				if (fn (data, key, len, value)) {
+					befs_put_node (node);
+					return 1;
+				}
+			}
+		}
+
+		next = node->right;
+		befs_put_node (node);
+
+		scan->node = next;
+		scan->key = 0;
+		scan->dup = 0;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Records of BEFS_IOC_SCAN
+ */
+
+typedef struct _befs_scan_buf {
+	befs_scan *	scan;
+	char *		buf;
+	int		size;
+	int		len;
+	int		err;
+	char		key[BEFS_NAME_LEN + 1];
+} befs_scan_buf;
+
+static int befs_scan_fill (void * data, const char * key, int len,
+	befs_off_t ino)
+{
+	befs_scan_buf * sbuf = (befs_scan_buf *) data;
+	befs_scan_rec   rec;
+
+	rec.ino = ino;
+	rec.rec_len = BEFS_SCAN_REC_LEN(len);
+	rec.key_len = len;
+
+	if (sbuf->len + rec.rec_len > sbuf->size)
+		return 1;
+
+	befs_scan_key (sbuf->scan, key, len, sbuf->key);
+	if (copy_to_user (sbuf->buf + sbuf->len, &rec, sizeof(rec))
+		|| copy_to_user (sbuf->buf + sbuf->len + sizeof(rec),
+		sbuf->key, len)) {
+		sbuf->err = -EFAULT;
+		return 1;
+	}
+	sbuf->len += rec.rec_len;
+
+	return 0;
+}
+
+
+/*
+ * befs_scan_index
+ *
+ * description:
+ *  BEFS_IOC_SCAN.  Fill records of keys and inodes from io->node.
+ *
+ * return value:
+ *  length of records
+ */
+
+int befs_scan_index (struct super_block * sb, befs_index_scan * io)
+{
+	befs_scan *    scan;
+	befs_scan_buf * buf;
+	char          name[BEFS_NAME_LEN + 1];
+	int           err;
+
+	if (io->index_len <= 0 || io->index_len > BEFS_NAME_LEN
+		|| io->size < 0)
+		return -EINVAL;
+	if (copy_from_user (name, io->index, io->index_len))
+		return -EFAULT;
+
+	if (io->node == BEFS_BT_NULL)
+		return 0;
+
+	scan = (befs_scan *) kmalloc (sizeof(befs_scan) + sizeof(befs_scan_buf),
+		GFP_KERNEL);
+	if (!scan)
+		return -ENOMEM;
+	buf = (befs_scan_buf *) (scan + 1);
+
+	err = befs_scan_open (sb, name, io->index_len, scan);
+	if (err)
+		goto out;
+
+	io->type = scan->type;
+
+	/*
+	 * keys of range are copied to key buffer of scan
+	 */
+
+	err = -EINVAL;
+	if ((io->low && (io->low_len < 0 || io->low_len > BEFS_NAME_LEN))
+		|| (io->high && (io->high_len < 0
+		|| io->high_len > BEFS_NAME_LEN)))
+		goto close;
+
+	err = -EFAULT;
+	if ((io->low && copy_from_user (scan->low_buf, io->low, io->low_len))
+		|| (io->high && copy_from_user (scan->high_buf, io->high,
+		io->high_len)))
+		goto close;
+
+	err = befs_scan_range (scan, io->low ? scan->low_buf : NULL,
+		io->low_len, io->high ? scan->high_buf : NULL, io->high_len);
+	if (err)
+		goto close;
+
+	err = befs_scan_position (scan, io->node, io->key, io->dup);
+	if (err)
+		goto close;
+
+	buf->scan = scan;
+	buf->buf = (char *) io->buf;
+	buf->size = io->size;
+	buf->len = 0;
+	buf->err = 0;
+
+	/*
+	 * Scan stops when buffer is full.  If the first record does not fit,
+	 * buffer is too small.
+	 */
+
+	err = befs_scan_next (scan, befs_scan_fill, buf);
+	if (err > 0 && buf->err)
+		err = buf->err;
+	else if (err > 0 && !buf->len)
+		err = -ERANGE;
+	if (err >= 0) {
+		io->node = scan->node;
+		io->key = scan->key;
+		io->dup = scan->dup;
+		err = buf->len;
+	}
+
+close:
+	befs_scan_close (scan);
+out:
+	kfree (scan);
+
+	return err;
+}
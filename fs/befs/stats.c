@@ -0,0 +1,233 @@
+/*
+ *  linux/fs/befs/stats.c
+ *
+ * Copyright (C) 1999  Makoto Kato (m_kato@ga2.so-net.ne.jp)
+ *
+ *  Performance counters of BEFS.
+ */
+
+#include <linux/errno.h>
+#include <linux/fs.h>
+#include <linux/befs_fs.h>
+#include <linux/sched.h>
+#include <linux/stat.h>
+#include <linux/string.h>
+#include <linux/malloc.h>
+#include <linux/proc_fs.h>
+
+#include <asm/timex.h>
+
+
+static const char * befs_stat_names[BEFS_ST_NUM] = {
+	"file_read",
+	"find_entry",
+	"readdir",
+	"index_node",
+	"map_direct",
+	"map_indirect",
+	"map_double",
+	"read_inode",
+};
+
+#ifdef CONFIG_PROC_FS
+static struct proc_dir_entry * befs_proc_root = NULL;
+
+static int befs_stat_read_proc (char *, char **, off_t, int, int *, void *);
+#endif
+
+
+/*
+ * befs_stat_init
+ *
+ * description:
+ *  Allocate counters of super block, and make /proc/fs/befs/<dev>/stats.
+ *  Without counters, the file system works, but is not counted.
+ *
+ * return value:
+ *  0 ... success
+ */
+
+int befs_stat_init (struct super_block * sb)
+{
+	befs_stats * stats;
+#ifdef CONFIG_PROC_FS
+	struct proc_dir_entry * dir;
+	struct proc_dir_entry * entry;
+#endif
+
+	sb->u.befs_sb.stats = NULL;
+	sb->u.befs_sb.proc = NULL;
+
+	stats = (befs_stats *) kmalloc (sizeof(befs_stats) * NR_CPUS,
+		GFP_KERNEL);
+	if (!stats) {
+		printk (KERN_WARNING "BEFS: cannot allocate counters\n");
+		return -ENOMEM;
+	}
+	memset (stats, 0, sizeof(befs_stats) * NR_CPUS);
+	sb->u.befs_sb.stats = stats;
+
+#ifdef CONFIG_PROC_FS
+	if (!befs_proc_root)
+		return 0;
+
+	dir = create_proc_entry (bdevname (sb->s_dev), S_IFDIR,
+		befs_proc_root);
+	if (!dir)
+		return 0;
+
+	entry = create_proc_entry ("stats", S_IFREG | S_IRUGO, dir);
+	if (!entry) {
+		remove_proc_entry (bdevname (sb->s_dev), befs_proc_root);
+		return 0;
+	}
+	entry->read_proc = befs_stat_read_proc;
+	entry->data = sb;
+
+	sb->u.befs_sb.proc = dir;
+#endif
+
+	return 0;
+}
+
+
+void befs_stat_release (struct super_block * sb)
+{
+#ifdef CONFIG_PROC_FS
+	if (sb->u.befs_sb.proc) {
+		remove_proc_entry ("stats", sb->u.befs_sb.proc);
+		remove_proc_entry (bdevname (sb->s_dev), befs_proc_root);
+		sb->u.befs_sb.proc = NULL;
+	}
+#endif
+
+	if (sb->u.befs_sb.stats) {
+		kfree (sb->u.befs_sb.stats);
+		sb->u.befs_sb.stats = NULL;
+	}
+}
+
+
+/*
+ * befs_stat_end
+ *
+ * description:
+ *  Count one call of operation, which started at cycles start.
+ */
+
+void befs_stat_end (struct super_block * sb, int op, cycles_t start)
+{
+	befs_stat *    stat;
+	unsigned long d;
+	int           b;
+
+	if (!sb->u.befs_sb.stats)
+		return;
+
+	stat = &sb->u.befs_sb.stats[smp_processor_id()].stat[op];
+	d = (unsigned long) (get_cycles () - start);
+
+	stat->count++;
+	stat->cycles += d;
+
+	d >>= BEFS_ST_HIST_SHIFT;
+	for (b = 0; d && b < BEFS_ST_HIST - 1; b++)
+		d >>= 1;
+	stat->hist[b]++;
+}
+
+
+#ifdef CONFIG_PROC_FS
+/*
+ * befs_stat_read_proc
+ *
+ * description:
+ *  Show counters of all CPUs.  One line per operation:
+ *   name count bread alloc cycles hist[0] ... hist[BEFS_ST_HIST - 1]
+ *  Memory of node caches and name filters of all mounts follows.
+ */
+
+static int befs_stat_read_proc (char * page, char ** start, off_t off,
+	int count, int * eof, void * data)
+{
+	struct super_block * sb = (struct super_block *) data;
+	befs_stats *          stats = sb->u.befs_sb.stats;
+	befs_stat             sum;
+	befs_stat *           stat;
+	int                  len = 0;
+	int                  op;
+	int                  cpu;
+	int                  b;
+
+	len += sprintf (page + len, "# op count bread alloc cycles "
+		"hist(2^%d cycles ...)\n", BEFS_ST_HIST_SHIFT);
+
+	for (op = 0; op < BEFS_ST_NUM; op++) {
+		memset (&sum, 0, sizeof(sum));
+
+		for (cpu = 0; cpu < NR_CPUS; cpu++) {
+			stat = &stats[cpu].stat[op];
+
+			sum.count += stat->count;
+			sum.bread += stat->bread;
+			sum.alloc += stat->alloc;
+			sum.cycles += stat->cycles;
+			for (b = 0; b < BEFS_ST_HIST; b++)
+				sum.hist[b] += stat->hist[b];
+		}
+
+		len += sprintf (page + len, "%s %lu %lu %lu %Lu",
+			befs_stat_names[op], sum.count, sum.bread, sum.alloc,
+			sum.cycles);
+		for (b = 0; b < BEFS_ST_HIST; b++)
+			len += sprintf (page + len, " %lu", sum.hist[b]);
+		len += sprintf (page + len, "\n");
+	}
+
+	len += sprintf (page + len, "node_cache_bytes %d\n",
+		befs_node_cache_bytes);
+	len += sprintf (page + len, "bloom_bytes %d\n", befs_bloom_bytes);
+
+	if (len <= off + count)
+		*eof = 1;
+	*start = page + off;
+	len -= off;
+	if (len > count)
+		len = count;
+	if (len < 0)
+		len = 0;
+
+	return len;
+}
+#endif
+
+
+/*
+ * befs_stat_init_proc
+ *
+ * description:
+ *  Make /proc/fs/befs and /proc/fs/befs/trace at registering file system.
+ */
+
+int befs_stat_init_proc (void)
+{
+#ifdef CONFIG_PROC_FS
+	befs_proc_root = create_proc_entry ("fs/befs", S_IFDIR, 0);
+	befs_trace_init_proc (befs_proc_root);
+#endif
+
+	return 0;
+}
+
+
+void befs_stat_cleanup_proc (void)
+{
+	befs_trace_cleanup_proc ();
+
+#ifdef CONFIG_PROC_FS
+	if (befs_proc_root) {
+		remove_proc_entry ("fs/befs", 0);
+		befs_proc_root = NULL;
+	}
+#endif
+}
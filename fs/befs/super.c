@@ -33,6 +33,8 @@
 
 void befs_put_super (struct super_block * sb)
 {
+	befs_stat_release (sb);
+
 	if (sb->u.befs_sb.mount_opts.iocharset) {
 		kfree (sb->u.befs_sb.mount_opts.iocharset);
 		sb->u.befs_sb.mount_opts.iocharset = NULL;
@@ -68,13 +70,15 @@ static const struct super_operations befs_sops =
 	NULL,				/* write_super */
 #endif
 	befs_statfs,			/* statfs */
-	befs_remount			/* remount_fs */
+	befs_remount,			/* remount_fs */
+	befs_clear_inode		/* clear_inode */
 };
 
 
 static int parse_options (char *, befs_mount_options *);
 static void befs_convert_super_block (int, befs_super_block *,
 	befs_super_block *);
+static befs_super_block * befs_find_super_block (char *, int *);
 
 static int parse_options (char *options, befs_mount_options * opts)
 {
@@ -87,11 +91,7 @@ static int parse_options (char *options, befs_mount_options * opts)
 	 */
 	opts->uid = 0;
 	opts->gid = 0;
-#ifdef CONFIG_PPC
-	opts->befs_type = BEFS_PPC;
-#else
-	opts->befs_type = BEFS_X86;
-#endif
+	opts->befs_type = 0;	/* detect at mount */
 
 	if (!options)
 		return ret;
@@ -149,7 +149,14 @@ static int parse_options (char *options, befs_mount_options * opts)
 			while (*value && *value != ',')
 				value++;
 			len = value - p;
-			if (len) { 
+			if (len == 4 && !strncmp (p, "utf8", 4)) {
+
+				/*
+				 * Names on disk are UTF-8 already.
+				 */
+
+				printk (KERN_INFO "BEFS: IO charset utf8\n");
+			} else if (len) { 
 				char * buffer = kmalloc (len+1, GFP_KERNEL);
 				if (buffer) {
 					opts->iocharset = buffer;
@@ -178,54 +185,81 @@ static int parse_options (char *options, befs_mount_options * opts)
 static void befs_convert_super_block (int fstype, befs_super_block * bs,
 	befs_super_block * out)
 {
-	switch (fstype)
-	{
-	case BEFS_X86:
-		out->magic1 = le32_to_cpu(bs->magic1);
-		out->block_size = le32_to_cpu(bs->block_size);
-		out->block_shift = le32_to_cpu(bs->block_shift);
-		out->num_blocks = le64_to_cpu(bs->num_blocks);
-		out->used_blocks = le64_to_cpu(bs->used_blocks);
-		out->inode_size = le32_to_cpu(bs->inode_size);
-		out->magic2 = le32_to_cpu(bs->magic2);
-		out->blocks_per_ag = le32_to_cpu(bs->blocks_per_ag);
-		out->ag_shift = le32_to_cpu(bs->ag_shift);
-		out->num_ags = le32_to_cpu(bs->num_ags);
-		out->flags = le32_to_cpu(bs->flags);
-		befs_convert_inodeaddr (fstype, &(bs->log_blocks),
-			&(out->log_blocks));
-		out->log_start = le64_to_cpu(bs->log_start);
-		out->log_end = le64_to_cpu(bs->log_end);
-		out->magic3 = le32_to_cpu(bs->magic3);
-		befs_convert_inodeaddr (fstype, &(bs->root_dir),
-			&(out->root_dir));
-		befs_convert_inodeaddr (fstype, &(bs->indices),
-			&(out->indices));
-		break;
-
-	case BEFS_PPC:
-		out->magic1 = be32_to_cpu(bs->magic1);
-		out->block_size = be32_to_cpu(bs->block_size);
-		out->block_shift = be32_to_cpu(bs->block_shift);
-		out->num_blocks = be64_to_cpu(bs->num_blocks);
-		out->used_blocks = be64_to_cpu(bs->used_blocks);
-		out->inode_size = be32_to_cpu(bs->inode_size);
-		out->magic2 = be32_to_cpu(bs->magic2);
-		out->blocks_per_ag = be32_to_cpu(bs->blocks_per_ag);
-		out->ag_shift = be32_to_cpu(bs->ag_shift);
-		out->num_ags = be32_to_cpu(bs->num_ags);
-		out->flags = be32_to_cpu(bs->flags);
-		befs_convert_inodeaddr (fstype, &(bs->log_blocks),
-			&(out->log_blocks));
-		out->log_start = be64_to_cpu(bs->log_start);
-		out->log_end = be64_to_cpu(bs->log_end);
-		out->magic3 = be32_to_cpu(bs->magic3);
-		befs_convert_inodeaddr (fstype, &(bs->root_dir),
-			&(out->root_dir));
-		befs_convert_inodeaddr (fstype, &(bs->indices),
-			&(out->indices));
-		break;
+	out->magic1 = befs32_to_cpu(fstype, bs->magic1);
+	out->block_size = befs32_to_cpu(fstype, bs->block_size);
+	out->block_shift = befs32_to_cpu(fstype, bs->block_shift);
+	out->num_blocks = befs64_to_cpu(fstype, bs->num_blocks);
+	out->used_blocks = befs64_to_cpu(fstype, bs->used_blocks);
+	out->inode_size = befs32_to_cpu(fstype, bs->inode_size);
+	out->magic2 = befs32_to_cpu(fstype, bs->magic2);
+	out->blocks_per_ag = befs32_to_cpu(fstype, bs->blocks_per_ag);
+	out->ag_shift = befs32_to_cpu(fstype, bs->ag_shift);
+	out->num_ags = befs32_to_cpu(fstype, bs->num_ags);
+	out->flags = befs32_to_cpu(fstype, bs->flags);
+	befs_convert_inodeaddr (fstype, &(bs->log_blocks),
+		&(out->log_blocks));
+	out->log_start = befs64_to_cpu(fstype, bs->log_start);
+	out->log_end = befs64_to_cpu(fstype, bs->log_end);
+	out->magic3 = befs32_to_cpu(fstype, bs->magic3);
+	befs_convert_inodeaddr (fstype, &(bs->root_dir),
+		&(out->root_dir));
+	befs_convert_inodeaddr (fstype, &(bs->indices),
+		&(out->indices));
+}
+
+
+/*
+ * befs_find_super_block
+ *
+ * description:
+ *  Find super block in first 1024 bytes of device.  BeOS(x86) puts it at
+ *  offset 512, and BeOS(ppc) puts it at offset 0.  Both places are checked
+ *  with both byte orders.  The place and byte order of "type" option, or
+ *  else of this platform, are checked first.
+ *
+ * parameter:
+ *  data   ... first 1024 bytes of device
+ *  fstype ... hint of filesystem type (0 is none), byte order return
+ *
+ * return value:
+ *  super block (raw disk format), or NULL if not found.
+ */
+
+static befs_super_block * befs_find_super_block (char * data, int * fstype)
+{
+	befs_super_block * bs;
+	int               types[2];
+	int               ntypes;
+	int               place;
+	int               i;
+	int               j;
+
+	types[0] = *fstype ? *fstype : BEFS_NATIVE_TYPE;
+	ntypes = 1;
+#ifdef CONFIG_BEFS_CONV
+	types[1] = types[0] == BEFS_X86 ? BEFS_PPC : BEFS_X86;
+	ntypes = 2;
+#endif
+
+	for (i = 0; i < 2; i++) {
+		place = (types[0] == BEFS_X86) ^ i;
+		bs = (befs_super_block *) (data + (place ? 512 : 0));
+
+		for (j = 0; j < ntypes; j++) {
+			if (befs32_to_cpu(types[j], bs->magic1)
+					== BEFS_SUPER_BLOCK_MAGIC1
+				&& befs32_to_cpu(types[j], bs->magic2)
+					== BEFS_SUPER_BLOCK_MAGIC2
+				&& befs32_to_cpu(types[j], bs->magic3)
+					== BEFS_SUPER_BLOCK_MAGIC3) {
+
+				*fstype = types[j];
+				return bs;
+			}
+		}
 	}
+
+	return NULL;
 }
 
 
@@ -233,9 +267,9 @@ struct super_block * befs_read_super (struct super_block *sb, void *data,
 	int silent )
 {
 	befs_super_block *    bs = NULL;
+	befs_super_block      bs_conv;
 	kdev_t               dev = sb->s_dev;
-	int                  blocksize;
-	unsigned long        logic_sb_block;
+	int                  fstype;
 	struct buffer_head * bh;
 
 	BEFS_OUTPUT (("---> befs_read_super()\n"));
@@ -249,69 +283,38 @@ struct super_block * befs_read_super (struct super_block *sb, void *data,
 		return NULL;
 	}
 
-	/*
-	 * Set dummy blocksize to read super block.
-	 */
-
-	switch (BEFS_TYPE(sb))
-	{
-	case BEFS_X86:
-		blocksize = 512;
-		logic_sb_block = 1;
-		break;
-
-	case BEFS_PPC:
-		blocksize = 1024;
-		logic_sb_block = 0;
-		break;
-
-	default:
-		printk (KERN_ERR "BEFS: cannot parse filesystem type\n");
-		return NULL;	
-	}
-
 	MOD_INC_USE_COUNT;
 	lock_super (sb);
-	set_blocksize (dev, blocksize);
 
 	/*
-	 * Get BEFS super block.
+	 * Read first 1024 bytes which have super block of both BeOS(x86)
+	 * and BeOS(ppc).
 	 */
 
-	if (!(bh = bread (dev, logic_sb_block, blocksize))) {
+	set_blocksize (dev, 1024);
+
+	if (!(bh = bread (dev, 0, 1024))) {
 		printk (KERN_ERR "BEFS: unable to read superblock\n");
 		goto bad_befs_read_super;
 	}
 
-	bs = (befs_super_block *) bh->b_data;
-
-#ifdef CONFIG_BEFS_CONV
-	/*
-	 * Convert byte order
-	 */
-
-	bs = (befs_super_block *) __getname();
+	fstype = BEFS_TYPE(sb);
+	bs = befs_find_super_block (bh->b_data, &fstype);
 	if (!bs) {
-		brelse(bh);
+		brelse (bh);
+		printk (KERN_ERR "BEFS: different magic header\n");
 		goto bad_befs_read_super;
 	}
-	befs_convert_super_block (BEFS_TYPE(sb),
-		(befs_super_block *) bh->b_data, bs);	
-#endif
-	BEFS_DUMP_SUPER_BLOCK (bs);
+	BEFS_TYPE(sb) = fstype;
 
 	/*
-	 * Check magic headers of super block
+	 * Convert byte order
 	 */
 
-	if ((bs->magic1 != BEFS_SUPER_BLOCK_MAGIC1)
-		|| (bs->magic2 != BEFS_SUPER_BLOCK_MAGIC2)
-		|| (bs->magic3 != BEFS_SUPER_BLOCK_MAGIC3)) {
+	befs_convert_super_block (fstype, bs, &bs_conv);
+	bs = &bs_conv;
 
-		brelse (bh);
-		printk (KERN_ERR "BEFS: different magic header\n");
-		goto bad_befs_read_super;
-	}
+	BEFS_DUMP_SUPER_BLOCK (bs);
 
 	/*
 	 * Check blocksize of BEFS.
@@ -319,10 +322,11 @@ struct super_block * befs_read_super (struct super_block *sb, void *data,
 	 * Blocksize of BEFS is 1024, 2048, 4096 or 8192.
 	 */
 
-	if( (bs->block_size != 1024)
+	if( ((bs->block_size != 1024)
 		&& (bs->block_size != 2048)
 		&& (bs->block_size != 4096)
-		&& (bs->block_size != 8192)) {
+		&& (bs->block_size != 8192))
+		|| (1 << bs->block_shift) != bs->block_size) {
 
 		brelse (bh);
 		printk (KERN_ERR "BEFS: different blocksize\n");
@@ -337,6 +341,7 @@ struct super_block * befs_read_super (struct super_block *sb, void *data,
 
 	sb->s_magic = BEFS_SUPER_MAGIC;
 	sb->s_blocksize = (int) bs->block_size;
+	sb->s_blocksize_bits = bs->block_shift;
 
 	sb->u.befs_sb.block_size = bs->block_size;
 	sb->u.befs_sb.block_shift = bs->block_shift;
@@ -355,6 +360,8 @@ struct super_block * befs_read_super (struct super_block *sb, void *data,
 	sb->u.befs_sb.root_dir = bs->root_dir;
 	sb->u.befs_sb.indices = bs->indices;
 
+	befs_stat_init (sb);
+
 	unlock_super (sb);
 
 	/*
@@ -367,6 +374,7 @@ struct super_block * befs_read_super (struct super_block *sb, void *data,
 		BEFS_IADDR2INO(&(bs->root_dir),bs)));
 
 	if (!sb->s_root) {
+		befs_stat_release (sb);
 		sb->s_dev = 0;
 		brelse (bh);
 		printk (KERN_ERR "BEFS: get root inode failed\n");
@@ -387,12 +395,11 @@ struct super_block * befs_read_super (struct super_block *sb, void *data,
 			sb->u.befs_sb.nls = load_nls_default ();
 		}
 	} else {
+		sb->u.befs_sb.nls = NULL;
 	}
+	sb->u.befs_sb.nls_ascii = befs_nls_ascii (sb->u.befs_sb.nls);
 
 	brelse (bh);
-#ifdef CONFIG_BEFS_CONV
-	putname (bs);
-#endif
 
 	return sb;
 
@@ -401,10 +408,6 @@ bad_befs_read_super:
 	unlock_super (sb);
 
 uninit_last_befs_read_super:
-#ifdef CONFIG_BEFS_CONV
-	if (bs)
-		putname (bs);
-#endif
 	MOD_DEC_USE_COUNT;
 
 	return NULL;
@@ -429,6 +432,8 @@ static struct file_system_type befs_fs_type = {
 
 int __init init_befs_fs(void)
 {
+	befs_stat_init_proc ();
+
 	return register_filesystem(&befs_fs_type);
 }
 
@@ -444,6 +449,7 @@ int init_module(void)
 void cleanup_module(void)
 {
 	unregister_filesystem(&befs_fs_type);
+	befs_stat_cleanup_proc ();
 }
 
 #endif
@@ -72,7 +72,7 @@ static int befs_readlink (struct dentry * dentry, char * buffer, int buflen)
         char *         link = inode->u.befs_i.i_data.symlink;
         int            len = 0;
         int            len_dist;
-	char *         tmpname;
+	char           nlsname[BEFS_SYMLINK_LEN + 1];
 
         if (buflen > BEFS_SYMLINK_LEN)
                 buflen = BEFS_SYMLINK_LEN;
@@ -80,13 +80,19 @@ static int befs_readlink (struct dentry * dentry, char * buffer, int buflen)
         while (len < buflen && link[len])
                 len++;
 
-	if (!befs_utf2nls (link, len, &tmpname, &len_dist, inode->i_sb))
-		return -ENOMEM;
-
-        if (copy_to_user(buffer, tmpname, len_dist))
-                len = -EFAULT;
-
-	putname (tmpname);
+	if (BEFS_NAME_PASSTHROUGH(inode->i_sb)) {
+		if (copy_to_user(buffer, link, len))
+			len = -EFAULT;
+	} else {
+		len_dist = befs_utf2nls (link, len, nlsname, sizeof(nlsname),
+			inode->i_sb);
+		if (len_dist < 0)
+			return len_dist;
+
+		len = len_dist;
+		if (copy_to_user(buffer, nlsname, len_dist))
+			len = -EFAULT;
+	}
 
         UPDATE_ATIME(inode);
 
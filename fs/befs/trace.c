@@ -0,0 +1,312 @@
+/*
+ *  linux/fs/befs/trace.c
+ *
+ * Copyright (C) 1999  Makoto Kato (m_kato@ga2.so-net.ne.jp)
+ *
+ *  Binary trace of BEFS operations.
+ */
+
+#include <linux/errno.h>
+#include <linux/fs.h>
+#include <linux/befs_fs.h>
+#include <linux/sched.h>
+#include <linux/stat.h>
+#include <linux/string.h>
+#include <linux/malloc.h>
+#include <linux/proc_fs.h>
+
+#include <asm/timex.h>
+#include <asm/uaccess.h>
+#include <asm/system.h>
+#include <asm/semaphore.h>
+
+
+int befs_trace_on = 0;
+
+static befs_trace_rec * befs_trace_buf[NR_CPUS];
+static unsigned int     befs_trace_pos[NR_CPUS];
+static int              befs_trace_busy[NR_CPUS];	/* recording now */
+
+/*
+ * befs_trace_sem serializes start, stop, reading and release of rings.
+ */
+
+static DECLARE_MUTEX(befs_trace_sem);
+
+#ifdef CONFIG_PROC_FS
+static struct proc_dir_entry * befs_trace_dir = NULL;
+
+static int befs_trace_read_proc (char *, char **, off_t, int, int *, void *);
+static int befs_trace_write_proc (struct file *, const char *,
+	unsigned long, void *);
+#endif
+
+
+/*
+ * befs_trace
+ *
+ * description:
+ *  Record one operation, which started at cycles start, into ring of
+ *  this CPU.  run may be NULL.  befs_trace_busy of this CPU is set while
+ *  recording, so that befs_trace_stop can wait for it.
+ */
+
+void befs_trace (int op, unsigned long ino, befs_block_run * run,
+	cycles_t start)
+{
+	int              cpu = smp_processor_id();
+	befs_trace_rec * buf;
+	befs_trace_rec * rec;
+
+	befs_trace_busy[cpu] = 1;
+	mb ();
+
+	buf = befs_trace_buf[cpu];
+	if (!befs_trace_on || !buf) {
+		befs_trace_busy[cpu] = 0;
+		return;
+	}
+
+	rec = &buf[befs_trace_pos[cpu]++ & (BEFS_TRACE_LEN - 1)];
+
+	rec->time = (__u32) start;
+	rec->duration = (__u32) (get_cycles () - start);
+	rec->ino = (__u32) ino;
+	rec->op = op;
+	rec->cpu = cpu;
+	if (run)
+		rec->run = *run;
+	else
+		memset (&rec->run, 0, sizeof(befs_block_run));
+
+	wmb ();
+	befs_trace_busy[cpu] = 0;
+}
+
+
+/*
+ * befs_trace_stop
+ *
+ * description:
+ *  Stop tracing, and wait until no CPU is recording.
+ */
+
+static void befs_trace_stop (void)
+{
+	int cpu;
+
+	befs_trace_on = 0;
+	mb ();
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++)
+		while (befs_trace_busy[cpu])
+			barrier ();
+}
+
+
+/*
+ * befs_trace_enable
+ *
+ * description:
+ *  Start or stop tracing.  Rings are allocated at first start, and are
+ *  kept after stop for reading.  Rings are reset only after recording
+ *  is stopped on all CPUs.
+ */
+
+static int befs_trace_enable (int on)
+{
+	int cpu;
+	int err = 0;
+
+	down (&befs_trace_sem);
+
+	befs_trace_stop ();
+	if (!on)
+		goto out;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		if (befs_trace_buf[cpu])
+			continue;
+
+		befs_trace_buf[cpu] = (befs_trace_rec *) kmalloc (
+			sizeof(befs_trace_rec) * BEFS_TRACE_LEN, GFP_KERNEL);
+		if (!befs_trace_buf[cpu]) {
+			printk (KERN_WARNING "BEFS: cannot allocate trace\n");
+			err = -ENOMEM;
+			goto out;
+		}
+	}
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++)
+		befs_trace_pos[cpu] = 0;
+
+	wmb ();
+	befs_trace_on = 1;
+
+out:
+	up (&befs_trace_sem);
+
+	return err;
+}
+
+
+#ifdef CONFIG_PROC_FS
+/*
+ * befs_trace_read_proc
+ *
+ * description:
+ *  Give records of all CPUs.  Records of each CPU are oldest first.
+ *  Rings are read only while tracing is stopped, or else records would
+ *  be torn.
+ */
+
+static int befs_trace_read_proc (char * page, char ** start, off_t off,
+	int count, int * eof, void * data)
+{
+	off_t         pos = 0;
+	int           len = 0;
+	int           cpu;
+	unsigned int  n;
+	unsigned int  first;
+	unsigned int  i;
+	char *        rec;
+	int           size = sizeof(befs_trace_rec);
+
+	*start = page;
+
+	down (&befs_trace_sem);
+	if (befs_trace_on) {
+		up (&befs_trace_sem);
+		return -EBUSY;
+	}
+
+	for (cpu = 0; cpu < NR_CPUS && len < count; cpu++) {
+		if (!befs_trace_buf[cpu])
+			continue;
+
+		n = befs_trace_pos[cpu];
+		first = 0;
+		if (n > BEFS_TRACE_LEN) {
+			first = n & (BEFS_TRACE_LEN - 1);
+			n = BEFS_TRACE_LEN;
+		}
+
+		if (pos + n * size <= off) {
+			pos += n * size;
+			continue;
+		}
+
+		for (i = 0; i < n && len < count; i++, pos += size) {
+			int o = 0;
+			int l = size;
+
+			if (pos + size <= off)
+				continue;
+			if (pos < off) {
+				o = off - pos;
+				l -= o;
+			}
+			if (l > count - len)
+				l = count - len;
+
+			rec = (char *) &befs_trace_buf[cpu][(first + i)
+				& (BEFS_TRACE_LEN - 1)];
+			memcpy (page + len, rec + o, l);
+			len += l;
+		}
+	}
+
+	up (&befs_trace_sem);
+
+	if (len < count)
+		*eof = 1;
+
+	return len;
+}
+
+
+/*
+ * befs_trace_write_proc
+ *
+ * description:
+ *  "1" starts tracing, "0" stops it.
+ */
+
+static int befs_trace_write_proc (struct file * file, const char * buffer,
+	unsigned long count, void * data)
+{
+	char c;
+	int  err;
+
+	if (!count)
+		return 0;
+	if (get_user (c, buffer))
+		return -EFAULT;
+
+	switch (c) {
+	case '0':
+		err = befs_trace_enable (0);
+		break;
+	case '1':
+		err = befs_trace_enable (1);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return err ? err : count;
+}
+#endif
+
+
+/*
+ * befs_trace_init_proc
+ *
+ * description:
+ *  Make /proc/fs/befs/trace.
+ */
+
+int befs_trace_init_proc (struct proc_dir_entry * dir)
+{
+#ifdef CONFIG_PROC_FS
+	struct proc_dir_entry * entry;
+
+	if (!dir)
+		return 0;
+
+	entry = create_proc_entry ("trace", S_IFREG | S_IRUSR | S_IWUSR, dir);
+	if (!entry)
+		return 0;
+	entry->read_proc = befs_trace_read_proc;
+	entry->write_proc = befs_trace_write_proc;
+
+	befs_trace_dir = dir;
+#endif
+
+	return 0;
+}
+
+
+void befs_trace_cleanup_proc (void)
+{
+	int cpu;
+
+	down (&befs_trace_sem);
+	befs_trace_stop ();
+
+#ifdef CONFIG_PROC_FS
+	if (befs_trace_dir) {
+		remove_proc_entry ("trace", befs_trace_dir);
+		befs_trace_dir = NULL;
+	}
+#endif
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		if (befs_trace_buf[cpu]) {
+			kfree (befs_trace_buf[cpu]);
+			befs_trace_buf[cpu] = NULL;
+		}
+	}
+
+	up (&befs_trace_sem);
+}
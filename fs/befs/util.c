@@ -7,39 +7,143 @@
 #include <linux/mm.h>
 #include <linux/fs.h>
 #include <linux/nls.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+
+#include <asm/unaligned.h>
 
 #define BEFS_UNKNOWN_CHAR '?'
 
+/*
+ * Bytes of a word: 0x0101...01 and 0x8080...80
+ */
+
+#define BEFS_WORD_ONES  (~0UL / 0xff)
+#define BEFS_WORD_HIGHS (BEFS_WORD_ONES * 0x80)
+
+
+/*
+ * befs_ascii_span
+ *
+ * description:
+ *  Count 7 bits ASCII characters at top of src, stopping at non-ASCII
+ *  byte or NUL.  A word is checked at once.
+ */
+
+static inline int befs_ascii_span (const char * src, int srclen)
+{
+	const char *  p = src;
+	unsigned long w;
+
+	while (srclen >= sizeof(unsigned long)) {
+		w = get_unaligned ((unsigned long *) p);
+
+		/*
+		 * high bit is set in some byte, or some byte is NUL
+		 */
+
+		if ((w | (w - BEFS_WORD_ONES)) & BEFS_WORD_HIGHS)
+			break;
+
+		p += sizeof(unsigned long);
+		srclen -= sizeof(unsigned long);
+	}
+
+	while (srclen > 0 && *p && !(*p & 0x80)) {
+		p++;
+		srclen--;
+	}
+
+	return p - src;
+}
+
+
+/*
+ * befs_nls_ascii
+ *
+ * description:
+ *  Check whether nls maps 7 bits ASCII to itself in both directions.
+ *  If so, ASCII names are copied without conversion.
+ */
+
+int befs_nls_ascii (struct nls_table * nls)
+{
+	unsigned char * page;
+	int             c;
+
+	if (!nls)
+		return 0;
+
+	page = nls->page_uni2charset[0];
+	if (!page)
+		return 0;
+
+	for (c = 1; c < 0x80; c++) {
+		if (page[c] != c || nls->charset2uni[c].uni1 != c
+			|| nls->charset2uni[c].uni2)
+			return 0;
+	}
+
+	return 1;
+}
+
 /*
  * UTF-8 to NLS charset  convert routine
+ *
+ * parameter:
+ *  src     ... name (UTF-8)
+ *  srclen  ... length of src
+ *  dist    ... converted name return (null terminated)
+ *  distlen ... size of dist
+ *  sb      ... super block
+ *
+ * return value:
+ *  length of converted name, or -ENAMETOOLONG if dist is too short.
  */
 
-char * befs_utf2nls (char * src, int srclen, char ** dist, int * len, struct super_block * sb)
+int befs_utf2nls (const char * src, int srclen, char * dist, int distlen,
+	struct super_block * sb)
 {
-	char *           out;
+	char *           out = dist;
+	char *           end = dist + distlen - 1;
 	unsigned char *  page;
 	struct nls_table * nls = sb->u.befs_sb.nls;
+	int              ascii = sb->u.befs_sb.nls_ascii;
 	__u16            w;
 	int              n;
 
 	BEFS_OUTPUT (("---> utf2nls()\n"));
 
-	*dist = out = (char *) __getname();
-	if (!out) {
-		BEFS_OUTPUT ((" cannot allocate memory\n"));
-		return NULL;
-	}
-
 	if (!nls) {
-		while (*src && srclen-- > 0)
+		while (srclen-- > 0 && *src) {
+			if (out >= end)
+				return -ENAMETOOLONG;
 			*out++ = *src++;
+		}
 	} else {
-		while (*src && srclen > 0) {
+		while (srclen > 0 && *src) {
+			/*
+			 * copy ASCII characters at once
+			 */
+
+			if (ascii && (n = befs_ascii_span (src, srclen))) {
+				if (n > end - out)
+					return -ENAMETOOLONG;
+				memcpy (out, src, n);
+				out += n;
+				src += n;
+				srclen -= n;
+				continue;
+			}
+
+			if (out >= end)
+				return -ENAMETOOLONG;
+
 			/*
 			 *  convert from UTF-8 to Unicode
 			 */
 
-			n = utf8_mbtowc(&w, src, srclen);
+			n = utf8_mbtowc(&w, (__u8 *) src, srclen);
 			if (n <= 0) {
 				/*
 				 * cannot convert from UTF-8 to unicode
@@ -66,40 +170,61 @@ char * befs_utf2nls (char * src, int srclen, char ** dist, int * len, struct sup
 		}
 	}
 	*out = '\0';
-	*len = out - (*dist);
 
 	BEFS_OUTPUT (("<--- utf2nls()\n"));
 
-	return *dist;
+	return out - dist;
 }
 
 
-char * befs_nls2utf (char * src, int srclen, char ** dist, int * len, struct super_block * sb)
+/*
+ * NLS charset to UTF-8 convert routine
+ *
+ *  Parameters and return value are same as befs_utf2nls().
+ */
+
+int befs_nls2utf (const char * src, int srclen, char * dist, int distlen,
+	struct super_block * sb)
 {
-	char *  out;
+	char *  out = dist;
+	char *  end = dist + distlen - 1;
 	__u16   w = 0;
+	int     c;
 	struct nls_table * nls = sb->u.befs_sb.nls;
+	int     ascii = sb->u.befs_sb.nls_ascii;
 	int     n;
 
 	BEFS_OUTPUT (("---> nls2utf()\n"));
 
-	*dist = out = (char *) __getname();
-	if (!out) {
-		BEFS_OUTPUT ((" cannot allocate memory\n"));
-		return NULL;
-	}
-
 	if (!nls) {
-		while (*src && srclen-- > 0)
+		while (srclen-- > 0 && *src) {
+			if (out >= end)
+				return -ENAMETOOLONG;
 			*out++ = *src++;
+		}
 	} else {
-		while (*src && srclen > 0) {
+		while (srclen > 0 && *src) {
+			/*
+			 * copy ASCII characters at once
+			 */
+
+			if (ascii && (n = befs_ascii_span (src, srclen))) {
+				if (n > end - out)
+					return -ENAMETOOLONG;
+				memcpy (out, src, n);
+				out += n;
+				src += n;
+				srclen -= n;
+				continue;
+			}
+
 			/*
 			 * convert from nls to unicode
 			 */
 
-			w = (((__u16) nls->charset2uni[(int) *src].uni2) << 8)
-				+ nls->charset2uni[(int) *src].uni1;
+			c = (unsigned char) *src;
+			w = (((__u16) nls->charset2uni[c].uni2) << 8)
+				+ nls->charset2uni[c].uni1;
 			src++;
 			srclen--;
 
@@ -107,10 +232,15 @@ char * befs_nls2utf (char * src, int srclen, char ** dist, int * len, struct sup
 			 * convert from unicode to UTF-8
 			 */
 
-			n = utf8_wctomb(out, w, 6);
+			n = utf8_wctomb((__u8 *) out, w, end - out);
 			if (n <= 0) {
-				*out++ = BEFS_UNKNOWN_CHAR;
-				continue;
+
+				/*
+				 * Unicode of 16 bits is 3 bytes at most in
+				 * UTF-8, so fail only when dist is short.
+				 */
+
+				return -ENAMETOOLONG;
 			}
 
 			out += n;
@@ -118,9 +248,8 @@ char * befs_nls2utf (char * src, int srclen, char ** dist, int * len, struct sup
 	}
 
 	*out = '\0';
-	*len = out - (*dist);
 
 	BEFS_OUTPUT (("<--- nls2utf()\n"));
 
-	return *dist;
+	return out - dist;
 }
@@ -8,6 +8,7 @@
 #define _LINUX_BEFS_FS
 
 #include <linux/types.h>
+#include <linux/ioctl.h>
 
 /*
  * for debug
@@ -57,10 +58,51 @@
 
 #define BEFS_INDEX_MAGIC 0x69f6c2e8
 
+/*
+ * Special link values of index node
+ */
+
+#define BEFS_BT_NULL ((befs_off_t) -1)
+#define BEFS_BT_FREE ((befs_off_t) -2)
+
+/*
+ * Max depth of index.  A tree of more levels is broken, and descending it
+ * may loop on a node which links to itself.
+ */
+
+#define BEFS_BT_MAX_LEVELS 32
+
+/*
+ * Duplicate keys of index.  Top 2 bits of value is link type.  Values of
+ * a key are in duplicate nodes linked by right link, or in a fragment of
+ * node shared by some keys.
+ */
+
+#define BEFS_BT_LINK_TYPE(v)       ((int) ((__u64) (v) >> 62))
+#define BEFS_BT_DUP_NODE           2
+#define BEFS_BT_DUP_FRAGMENT       3
+#define BEFS_BT_FRAGMENT_OFFSET(v) ((v) & 0x3ffffffffffffc00LL)
+#define BEFS_BT_FRAGMENT_INDEX(v)  ((int) ((v) & 0x3ff))
+#define BEFS_BT_FRAGMENT_VALUES    7
+
+/*
+ * Key types of index
+ */
+
+#define BEFS_STRING_TYPE 0
+#define BEFS_INT32_TYPE  1
+#define BEFS_UINT32_TYPE 2
+#define BEFS_INT64_TYPE  3
+#define BEFS_UINT64_TYPE 4
+#define BEFS_FLOAT_TYPE  5
+#define BEFS_DOUBLE_TYPE 6
+
 #define BEFS_SUPER_MAGIC BEFS_SUPER_BLOCK_MAGIC1
 
 
 #define BEFS_NUM_DIRECT_BLOCKS 12
+#define BEFS_DBLINDIR_BRUN_LEN 4
+#define BEFS_INLINE_RUNS 4
 #define B_OS_NAME_LENGTH 32
 
 /*
@@ -100,6 +142,14 @@
 		(inode)->i_sb->u.befs_sb.ag_shift) \
 	+ (inode)->u.befs_i.i_inode_num.start)
 
+#define BEFS_I_RUNS(inode) \
+	((inode)->u.befs_i.i_inline ? (inode)->u.befs_i.i_data.run \
+		: (inode)->u.befs_i.i_data.runs)
+#define BEFS_I_INDIRECT(inode) \
+	(BEFS_I_RUNS(inode)[(inode)->u.befs_i.i_direct_count])
+#define BEFS_I_DOUBLE_INDIRECT(inode) \
+	(BEFS_I_RUNS(inode)[(inode)->u.befs_i.i_direct_count + 1])
+
 #define BEFS_BLOCK_PER_INODE(sb) \
 	((sb)->u.befs_sb.block_size / sizeof(befs_inode_addr))
 
@@ -109,6 +159,14 @@
 #define BEFS_TYPE(sb) \
 	((sb)->u.befs_sb.mount_opts.befs_type)
 
+/*
+ * Names are UTF-8 on disk.  Without nls (no iocharset, or iocharset=utf8),
+ * names are passed through without conversion.
+ */
+
+#define BEFS_NAME_PASSTHROUGH(sb) \
+	(!(sb)->u.befs_sb.nls)
+
 /* 
  * special type of BFS
  */
@@ -183,6 +241,27 @@ typedef struct _befs_small_data {
 	__u16	data_size;
 } __attribute__ ((packed)) befs_small_data;
 
+/*
+ * Small data follows data stream and pad of inode block (offset 232).
+ * symlink[] of befs_inode is longer than data stream, so it is not
+ * sizeof(befs_inode).  Each one is header, name, NUL and 2 bytes pad,
+ * data and NUL.  Name of the first one is BEFS_FILE_NAME_NAME, which
+ * holds file name.
+ */
+
+#define BEFS_FILE_NAME_NAME 0x13
+
+#define BEFS_SD_SIZE(name_size, data_size) \
+	(sizeof(befs_small_data) + (name_size) + 3 + (data_size) + 1)
+#define BEFS_SD_NAME(sd) ((char *) (sd) + sizeof(befs_small_data))
+#define BEFS_SD_DATA(sd) (BEFS_SD_NAME(sd) + (sd)->name_size + 3)
+#define BEFS_SD_NEXT(sd) \
+	((befs_small_data *) ((char *) (sd) \
+		+ BEFS_SD_SIZE((sd)->name_size, (sd)->data_size)))
+#define BEFS_INODE_SD(di) \
+	((befs_small_data *) ((char *) &(di)->data \
+		+ sizeof(befs_data_stream) + sizeof((di)->pad)))
+
 
 /* Inode structure */
 typedef struct _befs_inode {
@@ -229,6 +308,68 @@ typedef struct _befs_index_node {
 } __attribute__ ((packed)) befs_index_node;
 
 
+/*
+ * In-core extent map of data stream
+ */
+
+typedef struct _befs_extent {
+	befs_off_t	logical;	/* first block number in the file */
+	befs_block_run	run;
+} __attribute__ ((packed)) befs_extent;
+
+typedef struct _befs_extent_map {
+	int		count;		/* number of extents */
+	befs_off_t	blocks;		/* number of blocks in extents */
+	int		double_layout;	/* layout of double-indirect block */
+	befs_extent	extent[1];
+} befs_extent_map;
+
+
+/*
+ * Decoded index node
+ */
+
+typedef struct _befs_node {
+	struct _befs_node * next;	/* next node in cache of directory */
+	struct _befs_node * lru_next;	/* less recently used node */
+	struct _befs_node * lru_prev;	/* more recently used node */
+	struct inode *	dir;		/* directory of cache */
+	int		count;		/* reference count */
+	int		size;		/* allocated size */
+	befs_off_t	offset;		/* offset into data stream */
+	befs_off_t	left;
+	befs_off_t	right;
+	befs_off_t	overflow;
+	int		all_key_count;
+	int		all_key_length;
+	befs_off_t *	value;		/* value of each key */
+	__u16 *		key_end;	/* end offset of each key */
+	char *		key;		/* key data */
+} befs_node;
+
+/*
+ * Get key at position and its length from befs_node
+ */
+
+#define BEFS_NODE_KEY(node, pos, len) \
+	((len) = (node)->key_end[pos] - ((pos) ? (node)->key_end[(pos) - 1] : 0), \
+	(node)->key + ((pos) ? (node)->key_end[(pos) - 1] : 0))
+
+
+/*
+ * Name filter (Bloom filter) of directory
+ */
+
+typedef struct _befs_bloom {
+	int		bits;		/* number of bits (power of 2) */
+	int		size;		/* allocated size */
+	int		complete;	/* all keys are added */
+	void *		owner;		/* file which builds filter */
+	loff_t		next;		/* next position of readdir */
+	unsigned long	map[0];
+} befs_bloom;
+
+
 typedef struct _befs_mount_options {
 	gid_t	gid;
 	uid_t	uid;
@@ -237,15 +378,341 @@ typedef struct _befs_mount_options {
 } befs_mount_options;
 
 
+/*
+ * ioctl
+ *
+ *  BEFS_IOC_GETATTR  ... get data and type of attribute name
+ *  BEFS_IOC_LISTATTR ... get names of attributes, each followed by NUL
+ *
+ *  They return length of data, or needed length if size is 0.
+ */
+
+typedef struct _befs_attr_io {
+	const char *	name;		/* attribute name */
+	int		name_len;	/* length of name */
+	__u32		type;		/* attribute type return */
+	void *		buf;		/* buffer for data or names */
+	int		size;		/* size of buffer */
+} befs_attr_io;
+
+#define BEFS_IOC_GETATTR  _IOWR('b', 1, befs_attr_io)
+#define BEFS_IOC_LISTATTR _IOWR('b', 2, befs_attr_io)
+
+/*
+ *  BEFS_IOC_SCAN ... get keys from low to high and their inodes of index
+ *
+ *  Numeric keys are in CPU byte order.  Set node to 0 at first call, and
+ *  call again until node is BEFS_BT_NULL.  It returns length of records.
+ */
+
+typedef struct _befs_index_scan {
+	const char *	index;		/* index name */
+	int		index_len;	/* length of index name */
+	int		type;		/* key type return */
+	const void *	low;		/* lowest key, or NULL */
+	int		low_len;
+	const void *	high;		/* highest key, or NULL */
+	int		high_len;
+	befs_off_t	node;		/* position of scan */
+	int		key;
+	int		dup;
+	void *		buf;		/* buffer for records */
+	int		size;		/* size of buffer */
+} befs_index_scan;
+
+typedef struct _befs_scan_rec {
+	befs_off_t	ino;		/* inode number */
+	__u16		rec_len;	/* length of record */
+	__u16		key_len;	/* length of key */
+	char		key[0];
+} befs_scan_rec;
+
+#define BEFS_SCAN_REC_LEN(key_len) \
+	((sizeof(befs_scan_rec) + (key_len) + 7) & ~7)
+
+#define BEFS_IOC_SCAN     _IOWR('b', 3, befs_index_scan)
+
+/*
+ *  BEFS_IOC_QUERY      ... start query on root directory.  Inodes which
+ *                          match all predicates are kept in the file.
+ *  BEFS_IOC_QUERY_READ ... get records of next inodes of query.  It
+ *                          returns number of records, 0 at end.
+ *
+ *  BEFS_QUERY_MATCH matches string key with pattern of '*' and '?'.
+ *  Keys of "name" index are in iocharset as BEFS_IOC_FINDNAME, and keys
+ *  of other string indices are UTF-8.
+ */
+
+#define BEFS_QUERY_EQ    0
+#define BEFS_QUERY_LT    1
+#define BEFS_QUERY_LE    2
+#define BEFS_QUERY_GT    3
+#define BEFS_QUERY_GE    4
+#define BEFS_QUERY_MATCH 5
+
+#define BEFS_QUERY_MAX_PRED 8
+
+typedef struct _befs_query_pred {
+	const char *	index;		/* index name */
+	int		index_len;	/* length of index name */
+	int		op;		/* BEFS_QUERY_* */
+	const void *	key;		/* key (CPU byte order) or pattern */
+	int		key_len;
+} befs_query_pred;
+
+typedef struct _befs_query {
+	befs_query_pred *	pred;	/* predicates */
+	int			count;	/* number of predicates */
+} befs_query;
+
+typedef struct _befs_query_rec {
+	befs_off_t	ino;		/* inode number */
+	befs_off_t	parent;		/* inode number of parent */
+	befs_off_t	size;
+	__u32		mode;
+	__u32		uid;
+	__u32		gid;
+	__u32		mtime;
+} befs_query_rec;
+
+typedef struct _befs_query_buf {
+	befs_query_rec *	rec;	/* buffer for records */
+	int			count;	/* number of records in buffer */
+} befs_query_buf;
+
+#define BEFS_IOC_QUERY      _IOW('b', 4, befs_query)
+#define BEFS_IOC_QUERY_READ _IOWR('b', 5, befs_query_buf)
+
+/*
+ *  BEFS_IOC_FINDNAME ... find files of name (or names which start with
+ *                        name) in name index of volume.  Each record has
+ *                        inode numbers of parents up to root directory.
+ *
+ *  Set node to 0 at first call, and call again until node is
+ *  BEFS_BT_NULL.  It returns length of records.  A record is stored only
+ *  if the buffer has room for BEFS_NAME_REC_LEN(BEFS_FIND_MAX_DEPTH,
+ *  name_len), so size should be BEFS_FIND_MIN_SIZE at least.
+ */
+
+#define BEFS_FIND_MAX_DEPTH 64
+
+typedef struct _befs_find_name {
+	const char *	name;		/* name (iocharset) */
+	int		name_len;
+	int		prefix;		/* match names which start with name */
+	befs_off_t	node;		/* position of scan */
+	int		key;
+	int		dup;
+	void *		buf;		/* buffer for records */
+	int		size;		/* size of buffer */
+} befs_find_name;
+
+/*
+ * Record is followed by parent[depth] (parent first, root last) and name.
+ */
+
+typedef struct _befs_name_rec {
+	befs_off_t	ino;		/* inode number */
+	__u16		rec_len;	/* length of record */
+	__u16		depth;		/* number of parents */
+	__u16		name_len;	/* length of name */
+	__u16		pad;
+} befs_name_rec;
+
+#define BEFS_NAME_REC_LEN(depth, name_len) \
+	((sizeof(befs_name_rec) + (depth) * sizeof(befs_off_t) \
+		+ (name_len) + 7) & ~7)
+
+#define BEFS_FIND_MIN_SIZE \
+	BEFS_NAME_REC_LEN(BEFS_FIND_MAX_DEPTH, BEFS_NAME_LEN)
+
+#define BEFS_IOC_FINDNAME   _IOWR('b', 6, befs_find_name)
+
+/*
+ *  BEFS_IOC_BULKSTAT ... read stat records of all inodes of volume in
+ *                        order of blocks on disk, without lookup.
+ *
+ *  Set pos to 0 at first call, and call again until pos is BEFS_BT_NULL.
+ *  It returns number of records, which may be 0 before the end.
+ */
+
+typedef struct _befs_bulkstat_io {
+	befs_off_t		pos;	/* block number to continue */
+	befs_query_rec *	rec;	/* buffer for records */
+	int			count;	/* number of records in buffer */
+} befs_bulkstat_io;
+
+#define BEFS_IOC_BULKSTAT   _IOWR('b', 7, befs_bulkstat_io)
+
+
+/*
+ * Operations counted by performance counters and trace
+ */
+
+#define BEFS_ST_FILE_READ    0
+#define BEFS_ST_FIND_ENTRY   1
+#define BEFS_ST_READDIR      2
+#define BEFS_ST_INDEX_NODE   3
+#define BEFS_ST_MAP_DIRECT   4
+#define BEFS_ST_MAP_INDIRECT 5
+#define BEFS_ST_MAP_DOUBLE   6
+#define BEFS_ST_READ_INODE   7
+#define BEFS_ST_NUM          8
+
+/*
+ * Trace record
+ *
+ *  Reading /proc/fs/befs/trace gives these records, oldest first for each
+ *  CPU.  Each CPU keeps last BEFS_TRACE_LEN records.
+ */
+
+#define BEFS_TRACE_LEN 256
+
+typedef struct _befs_trace_rec {
+	__u32		time;		/* cycles at start (low 32 bits) */
+	__u32		duration;	/* cycles */
+	__u32		ino;		/* inode number */
+	__u16		op;		/* BEFS_ST_* */
+	__u16		cpu;
+	befs_block_run	run;		/* block run, or empty */
+} __attribute__ ((packed)) befs_trace_rec;
+
+
 #ifdef __KERNEL__
+
+#include <linux/smp.h>
+#include <asm/byteorder.h>
+#include <asm/timex.h>
+
+/*
+ * Byte order of volume
+ *
+ *  Convert a field of on-disk structure to CPU byte order.  If volume has
+ *  same byte order as CPU, these are plain loads.
+ */
+
+#ifdef __BIG_ENDIAN
+#define BEFS_NATIVE_TYPE BEFS_PPC
+#else
+#define BEFS_NATIVE_TYPE BEFS_X86
+#endif
+
+#ifdef CONFIG_BEFS_CONV
+static inline __u16 befs16_to_cpu (int fstype, __u16 v)
+{
+	if (fstype == BEFS_NATIVE_TYPE)
+		return v;
+	return fstype == BEFS_PPC ? be16_to_cpu(v) : le16_to_cpu(v);
+}
+
+static inline __u32 befs32_to_cpu (int fstype, __u32 v)
+{
+	if (fstype == BEFS_NATIVE_TYPE)
+		return v;
+	return fstype == BEFS_PPC ? be32_to_cpu(v) : le32_to_cpu(v);
+}
+
+static inline __u64 befs64_to_cpu (int fstype, __u64 v)
+{
+	if (fstype == BEFS_NATIVE_TYPE)
+		return v;
+	return fstype == BEFS_PPC ? be64_to_cpu(v) : le64_to_cpu(v);
+}
+#else
+#define befs16_to_cpu(fstype,v) ((__u16) (v))
+#define befs32_to_cpu(fstype,v) ((__u32) (v))
+#define befs64_to_cpu(fstype,v) ((__u64) (v))
+#endif
+
+
+/*
+ * Performance counters
+ *
+ *  Counters are per CPU and per super block.  They are shown in
+ *  /proc/fs/befs/<dev>/stats.  Histogram of latency has buckets of power
+ *  of 2 cycles from 2^BEFS_ST_HIST_SHIFT.
+ */
+
+#define BEFS_ST_HIST         16
+#define BEFS_ST_HIST_SHIFT   10
+
+typedef struct _befs_stat {
+	unsigned long	count;		/* number of calls */
+	unsigned long	bread;		/* number of buffer reads */
+	unsigned long	alloc;		/* number of allocations */
+	__u64		cycles;		/* total cycles */
+	unsigned long	hist[BEFS_ST_HIST];
+} befs_stat;
+
+typedef struct _befs_stats {
+	befs_stat	stat[BEFS_ST_NUM];
+} befs_stats;
+
+#define BEFS_STAT_ADD(sb,op,field,n) \
+	do { \
+		if ((sb)->u.befs_sb.stats) \
+			(sb)->u.befs_sb.stats[smp_processor_id()] \
+				.stat[op].field += (n); \
+	} while (0)
+
+#define BEFS_STAT_BREAD(sb,op,n) BEFS_STAT_ADD(sb, op, bread, n)
+#define BEFS_STAT_ALLOC(sb,op)   BEFS_STAT_ADD(sb, op, alloc, 1)
+#define BEFS_STAT_START()        get_cycles()
+
+/*
+ * Trace is recorded only while befs_trace_on is set.
+ */
+
+#define BEFS_TRACE(op,ino,run,start) \
+	do { \
+		if (befs_trace_on) \
+			befs_trace (op, ino, run, start); \
+	} while (0)
+
+
+/*
+ * Cursor of range scan over index
+ */
+
+typedef struct _befs_scan {
+	struct inode *	index;		/* inode of index */
+	int		type;		/* key type */
+	int		node_size;
+	int		node_shift;	/* node_size is 1 << node_shift */
+	befs_off_t	root;		/* root node */
+	int		levels;		/* max number of levels */
+	char *		low;		/* lowest key (CPU byte order) */
+	int		low_len;
+	char *		high;		/* highest key (CPU byte order) */
+	int		high_len;
+	befs_off_t	node;		/* leaf node, 0 before seek */
+	int		key;		/* key position in leaf node */
+	int		dup;		/* values done of duplicate key */
+	char		low_buf[BEFS_NAME_LEN + 1];
+	char		high_buf[BEFS_NAME_LEN + 1];
+} befs_scan;
+
+/*
+ * Called for each key and value.  Nonzero return stops scan before the
+ * value.
+ */
+
+typedef int (*befs_scan_fn) (void *, const char *, int, befs_off_t);
+
+
 /*
  * Function prototypes
  */
 
 /* file.c */
 extern int befs_read (struct inode *, struct file *, char *, int);
-extern befs_inode_addr befs_read_data_stream (struct super_block *,
-	befs_data_stream *, int *);
+extern int befs_get_block (struct inode *, long, struct buffer_head *, int);
+extern befs_inode_addr befs_read_data_stream (struct inode *, int *);
+extern befs_extent_map * befs_get_extent_map (struct inode *);
+extern void befs_put_extent_map (struct inode *);
+extern void befs_put_indirect_map (struct inode *);
+extern struct buffer_head * befs_bread_stream (struct inode *, befs_off_t);
+extern void befs_prefetch_stream (struct inode *, befs_off_t);
 
 /* inode.c */
 extern int befs_bmap (struct inode *, int);
@@ -254,8 +721,17 @@ extern struct buffer_head * befs_bread (struct inode *);
 extern struct buffer_head * befs_bread2 (struct super_block *, befs_inode_addr);
 extern void befs_write_inode (struct inode *);
 extern int befs_sync_inode (struct inode *);
+extern void befs_clear_inode (struct inode *);
+extern void befs_convert_inodeaddr (int, befs_inode_addr *, befs_inode_addr *);
+
+/* dir.c */
+extern int befs_bloom_test (struct inode *, const char *, int);
+extern void befs_put_bloom (struct inode *);
+extern int befs_bloom_bytes;
 
 /* namei.c */
+extern befs_off_t befs_find_entry (struct inode *, const char * const, int);
+extern int befs_lookup_name (struct super_block *, befs_find_name *);
 extern void befs_release (struct inode *, struct file *);
 extern int befs_lookup (struct inode *, struct dentry *);
 extern int befs_unlink (struct inode *, struct dentry *);
@@ -275,7 +751,17 @@ extern char * befs_get_key_from_index_node (befs_index_node *, int *, int,
 	char *, int *, befs_off_t *);
 extern struct buffer_head * befs_read_index_node (befs_inode_addr,
 	struct super_block *, int, befs_off_t *);
-extern void befs_convert_index_node (int, befs_index_node *, befs_index_node *);
+extern int befs_compare_key (const char *, int, const char *, int);
+extern int befs_read_index_header (struct inode *, befs_index_entry *);
+extern struct buffer_head * befs_read_node (struct inode *, befs_off_t,
+	befs_index_node **);
+extern befs_node * befs_get_node (struct inode *, befs_off_t);
+extern void befs_put_node (befs_node *);
+extern void befs_put_node_cache (struct inode *);
+extern int befs_node_cache_bytes;
+extern int befs_search_node (befs_node *, const char *, int, int *,
+	befs_off_t *);
+extern int befs_first_leaf (struct inode *, befs_index_entry *, befs_off_t *);
 
 /* debug.c */
 extern void befs_dump_super_block (befs_super_block *);
@@ -283,9 +769,55 @@ extern void befs_dump_inode (befs_inode *);
 extern void befs_dump_index_entry (befs_index_entry *);
 extern void befs_dump_index_node (befs_index_node *);
 
+/* stats.c */
+extern int befs_stat_init (struct super_block *);
+extern void befs_stat_release (struct super_block *);
+extern void befs_stat_end (struct super_block *, int, cycles_t);
+extern int befs_stat_init_proc (void);
+extern void befs_stat_cleanup_proc (void);
+
+/* trace.c */
+struct proc_dir_entry;
+
+extern int befs_trace_on;
+extern void befs_trace (int, unsigned long, befs_block_run *, cycles_t);
+extern int befs_trace_init_proc (struct proc_dir_entry *);
+extern void befs_trace_cleanup_proc (void);
+
+/* attr.c */
+extern int befs_read_small_data (struct inode *, int, befs_inode *, int);
+extern int befs_getattr (struct inode *, befs_attr_io *);
+extern int befs_listattr (struct inode *, befs_attr_io *);
+
+/* scan.c */
+extern int befs_scan_open (struct super_block *, const char *, int,
+	befs_scan *);
+extern int befs_scan_range (befs_scan *, const char *, int, const char *,
+	int);
+extern int befs_scan_position (befs_scan *, befs_off_t, int, int);
+extern int befs_scan_next (befs_scan *, befs_scan_fn, void *);
+extern void befs_scan_close (befs_scan *);
+extern int befs_scan_key (befs_scan *, const char *, int, char *);
+extern int befs_compare_typed (befs_scan *, const char *, int,
+	const char *, int);
+extern int befs_scan_index (struct super_block *, befs_index_scan *);
+
+/* query.c */
+extern int befs_query_start (struct file *, befs_query *);
+extern int befs_query_read (struct file *, befs_query_buf *);
+extern void befs_query_release (struct file *);
+
+/* bulkstat.c */
+extern int befs_bulkstat (struct super_block *, befs_bulkstat_io *);
+
+/* ioctl.c */
+extern int befs_ioctl (struct inode *, struct file *, unsigned int,
+	unsigned long);
+
 /* util.c */
-extern char * befs_utf2nls (char *, int, char **, int *, struct super_block *);
-extern char * befs_nls2utf (char *, int, char **, int *, struct super_block *);
+extern int befs_utf2nls (const char *, int, char *, int, struct super_block *);
+extern int befs_nls2utf (const char *, int, char *, int, struct super_block *);
+extern int befs_nls_ascii (struct nls_table *);
 
 /*
  * Inodes and files operations
@@ -15,22 +15,31 @@
 
 struct befs_inode_info {
 	befs_inode_addr	i_inode_num;
-	__u32	i_uid;
-	__u32	i_gid;
-	__u32	i_mode;
-	__u32	i_flags;
-
 	befs_inode_addr	i_parent;
 	befs_inode_addr	i_attribute;
+	__u32		i_type;		/* type of attribute inode */
+
+	/*
+	 * Block runs of data stream are direct block runs, indirect and
+	 * double indirect block.  They are kept into i_data.run if they are
+	 * few, or else allocated.  Symbolic link has allocated link name.
+	 */
 
-	__u32	i_type;
+	__u8	i_direct_count;		/* number of direct block runs */
+	__u8	i_inline;		/* i_data.run is used */
 
 	union {
-		befs_data_stream ds;
-		char            symlink[BEFS_SYMLINK_LEN];
+		befs_block_run	run[BEFS_INLINE_RUNS];
+		befs_block_run *	runs;
+		char *		symlink;
 	} i_data;
 
-	void * i_index_cache;
+	void * i_index_cache;	/* extent map of data stream */
+	befs_block_run * i_indirect;	/* block runs of indirect block */
+	befs_node * i_node_cache;	/* decoded index nodes of directory */
+	befs_bloom * i_bloom;		/* name filter of directory */
+	char * i_small_data;	/* small data attributes */
+	int i_small_size;	/* size of i_small_data */
 };
 
 #endif /* _LINUX_BEFS_FS_I */
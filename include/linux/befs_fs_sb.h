@@ -38,5 +38,9 @@ struct befs_sb_info {
 	befs_mount_options mount_opts;
 
 	struct nls_table * nls;
+	int nls_ascii;		/* nls maps 7 bits ASCII to itself */
+
+	befs_stats * stats;		/* performance counters per CPU */
+	struct proc_dir_entry * proc;	/* /proc/fs/befs/<dev> */
 };
 #endif
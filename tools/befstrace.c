@@ -0,0 +1,86 @@
+/*
+ *  tools/befstrace.c
+ *
+ * Copyright (C) 1999  Makoto Kato (m_kato@ga2.so-net.ne.jp)
+ *
+ *  Decode binary trace of BEFS (/proc/fs/befs/trace).
+ *
+ *  usage:
+ *   echo 1 > /proc/fs/befs/trace
+ *   ...
+ *   echo 0 > /proc/fs/befs/trace
+ *   cat /proc/fs/befs/trace > trace.bin
+ *   befstrace trace.bin
+ *
+ *  Decode on the machine of the same byte order as the traced one.
+ *
+ *  compile:
+ *   cc -O2 -I/usr/src/linux/include -o befstrace befstrace.c
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <linux/befs_fs.h>
+
+
+static const char * befs_trace_names[BEFS_ST_NUM] = {
+	"file_read",
+	"find_entry",
+	"readdir",
+	"index_node",
+	"map_direct",
+	"map_indirect",
+	"map_double",
+	"read_inode",
+};
+
+
+/*
+ * Display trace record in the same form as befs_dump_* functions.
+ */
+
+static void befs_dump_trace (befs_trace_rec * rec)
+{
+	printf (" befs_trace cpu %u\n", rec->cpu);
+
+	if (rec->op < BEFS_ST_NUM)
+		printf ("  op %s\n", befs_trace_names[rec->op]);
+	else
+		printf ("  op %u\n", rec->op);
+	printf ("  time %u\n", rec->time);
+	printf ("  duration %u\n", rec->duration);
+	printf ("  inode %u\n", rec->ino);
+	if (rec->run.allocation_group || rec->run.start || rec->run.len)
+		printf ("  block_run %u, %u, %u\n",
+			rec->run.allocation_group, rec->run.start,
+			rec->run.len);
+}
+
+
+int main (int argc, char ** argv)
+{
+	befs_trace_rec rec;
+	FILE *         fp = stdin;
+
+	if (argc > 2) {
+		fprintf (stderr, "usage: %s [trace file]\n", argv[0]);
+		return 1;
+	}
+
+	if (argc == 2 && strcmp (argv[1], "-")) {
+		fp = fopen (argv[1], "rb");
+		if (!fp) {
+			perror (argv[1]);
+			return 1;
+		}
+	}
+
+	while (fread (&rec, sizeof(rec), 1, fp) == 1)
+		befs_dump_trace (&rec);
+
+	if (fp != stdin)
+		fclose (fp);
+
+	return 0;
+}